@@ -9,9 +9,19 @@
 
 #include "FreeRTOS-Debug.h"
 
-#include <libopencm3/cm3/nvic.h>
+#if DEBUG_CLOCK == DEBUG_CLOCK_DWT
+    #include <libopencm3/cm3/dwt.h>
+#endif /* DEBUG_CLOCK == DEBUG_CLOCK_DWT */
+
+#if DEBUG_FAULT
+    #include <libopencm3/cm3/scb.h>
+#endif /* DEBUG_FAULT */
+
+#include <stdarg.h>
+#include <string.h>
 
 #include "queue.h"
+#include "semphr.h"
 
 /*----------------------------- Global Variables -----------------------------*/
 
@@ -19,131 +29,2455 @@
 static TaskHandle_t debug_task;
 
 #if DEBUG_LEVEL >= DEBUG_ERRORS
+    /** @brief Run-time level of each log module, see DEBUG_MODULE_ENABLED */
+    uint8_t debug_module_levels[DEBUG_MODULE_COUNT] = {
+        [0 ... DEBUG_MODULE_COUNT - 1] = DEBUG_MODULE_LEVEL
+    };
+
+    /** @brief Number of dropped messages of each type, see debug_drop_index */
+    static uint32_t debug_drops[3];
+
+    /** @brief Number of drops that have not been reported yet */
+    static uint32_t debug_drops_pending;
+
+    #if DEBUG_MODE == DEBUG_MODE_TEXT && DEBUG_STORAGE == DEBUG_STORAGE_POOL
+
+        /** @brief A pool block, which holds the next free block while unused */
+        typedef union debug_block {
+            union debug_block* next;
+            char message[DEBUG_POOL_BLOCK_SIZE];
+        } debug_block_t;
+
+        /** @brief The message pool itself */
+        static debug_block_t debug_pool[DEBUG_POOL_BLOCK_COUNT]
+                                                            DEBUG_BUFFER_ATTR;
+
+        /** @brief Head of the list of free blocks */
+        static debug_block_t* debug_pool_free;
+
+        /** @brief Number of messages lost because the pool was empty */
+        static uint32_t debug_pool_failures;
+
+    #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+
+    #if DEBUG_MODE == DEBUG_MODE_TEXT && \
+            DEBUG_STORAGE == DEBUG_STORAGE_HEAP && \
+            !configSUPPORT_DYNAMIC_ALLOCATION
+        #error "DEBUG_STORAGE_HEAP needs configSUPPORT_DYNAMIC_ALLOCATION!!!"
+    #endif /* DEBUG_STORAGE == DEBUG_STORAGE_HEAP */
+
+    #if DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TLS
+        #if configNUM_THREAD_LOCAL_STORAGE_POINTERS <= DEBUG_TLS_INDEX
+            #error "DEBUG_TLS_INDEX needs a free thread local storage slot!!!"
+        #endif /* configNUM_THREAD_LOCAL_STORAGE_POINTERS */
+    #elif DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_NUMBER
+        #if !configUSE_TRACE_FACILITY
+            #error "DEBUG_TASK_LOOKUP_NUMBER needs configUSE_TRACE_FACILITY!!!"
+        #endif /* configUSE_TRACE_FACILITY */
+    #elif DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TABLE
+        /** @brief Handles of the tasks that have logged, indexed by task ID */
+        static TaskHandle_t debug_task_handles[DEBUG_TASK_COUNT];
+    #else
+        #error "DEBUG_TASK_LOOKUP must be TABLE, TLS or NUMBER!!!"
+    #endif /* DEBUG_TASK_LOOKUP */
+
+    /**
+     * @brief Names of the tasks that have logged, indexed by task ID. Names
+     * are copied when a task first logs, so they outlive deleted tasks.
+     */
+    static char debug_task_names[DEBUG_TASK_COUNT][configMAX_TASK_NAME_LEN]
+                                                            DEBUG_BUFFER_ATTR;
+
+    /**
+     * @brief Task ID States. An ID is only given out again once the messages
+     * its deleted task left behind have been output, see debugTaskDeleted.
+     */
+    #define DEBUG_TASK_FREE         0   /* can be given out */
+    #define DEBUG_TASK_USED         1   /* held by a task */
+    #define DEBUG_TASK_DELETED      2   /* its task has been deleted */
+    #define DEBUG_TASK_RELEASING    3   /* free once the output is drained */
+
+    /** @brief State of each task ID */
+    static uint8_t debug_task_states[DEBUG_TASK_COUNT];
+
+    /** @brief Number of task IDs that are not DEBUG_TASK_FREE */
+    static UBaseType_t debug_tasks_taken;
+
+    /** @brief Number of task IDs waiting to be released */
+    static UBaseType_t debug_tasks_deleted;
+
+    /** @brief One more than the highest task ID that has been given out */
+    static UBaseType_t debug_tasks_registered;
+
+    #if DEBUG_MODE == DEBUG_MODE_BINARY
+        /** @brief Task IDs whose name has not been sent to the host yet */
+        static bool debug_names_unsent[DEBUG_TASK_COUNT];
+
+        /** @brief Number of names that have not been sent to the host */
+        static UBaseType_t debug_names_pending;
+    #endif /* DEBUG_MODE == DEBUG_MODE_BINARY */
+
+    #if DEBUG_FRAMED
+        /** @brief Number of timestamp chains, one per debug type */
+        #define DEBUG_FRAME_CHAINS (DEBUG_FULL - DEBUG_ERRORS + 1)
+
+        /**
+         * @brief Timestamp of the last record of each debug type or a more
+         * severe one, indexed by DEBUG_TYPE_LEVEL - DEBUG_ERRORS.
+         */
+        static uint32_t debug_frame_timestamps[DEBUG_FRAME_CHAINS];
+
+        /** @brief Records sent since each chain had a full timestamp */
+        static uint8_t debug_frame_deltas[DEBUG_FRAME_CHAINS] = {
+            [0 ... DEBUG_FRAME_CHAINS - 1] = DEBUG_FRAME_SYNC_INTERVAL
+        };
+
+        /** @brief Payload of the frame being encoded */
+        static uint8_t debug_frame_payload[DEBUG_RECORD_LENGTH];
+
+        /** @brief Length of the last payload encoded, with its CRC */
+        static size_t debug_frame_length;
+
+        /**
+         * @brief Longest frame payload with its CRC: type, timestamp (5 byte
+         * varint), task ID, IRQ (3), format (5), arguments (5 each) and CRC,
+         * or a name frame if task names are longer.
+         */
+        #define DEBUG_FRAME_RECORD_MAX (1 + 5 + 1 + 3 + 5 + \
+                                                    5 * DEBUG_MAX_ARGS + 2)
+        #define DEBUG_FRAME_NAME_MAX (2 + configMAX_TASK_NAME_LEN + 2)
+        #define DEBUG_FRAME_PAYLOAD_MAX \
+                    ((DEBUG_FRAME_RECORD_MAX > DEBUG_FRAME_NAME_MAX) ? \
+                    DEBUG_FRAME_RECORD_MAX : DEBUG_FRAME_NAME_MAX)
+
+        /* COBS adds a code byte per 254 bytes, then the delimiter follows */
+        _Static_assert(DEBUG_RECORD_LENGTH >= DEBUG_FRAME_PAYLOAD_MAX +
+                                        DEBUG_FRAME_PAYLOAD_MAX / 254 + 2,
+                    "DEBUG_RECORD_LENGTH is too short for the largest frame");
+    #endif /* DEBUG_FRAMED */
+
+    #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+
+        #if (DEBUG_RING_LENGTH & (DEBUG_RING_LENGTH - 1)) != 0
+            #error "DEBUG_RING_LENGTH must be a power of two!!!"
+        #endif /* DEBUG_RING_LENGTH */
+
+        /**
+         * @brief Single-producer/single-consumer ring of messages. The head is
+         * only written by the owning task and the tail only by the debug task
+         * (but see debug_ring_pop), so neither side needs a critical section.
+         */
+        typedef struct {
+            uint32_t head;
+            uint32_t tail;
+            debug_t slots[DEBUG_RING_LENGTH];
+        } debug_ring_t;
+
+        /** @brief The rings, indexed by the task ID of their owner */
+        static debug_ring_t debug_rings[DEBUG_TASK_COUNT] DEBUG_BUFFER_ATTR;
+
+        /** @brief Ring the debug task will check first on its next pass */
+        static UBaseType_t debug_ring_next;
+
+        #if DEBUG_ISR
+            /**
+             * @brief Ring shared by all interrupts. Nested interrupts are
+             * serialised by masking interrupts while a message is added.
+             */
+            static debug_ring_t debug_isr_ring DEBUG_BUFFER_ATTR;
+        #endif /* DEBUG_ISR */
+
+    #else
+
+        /** @brief The queue itself */
+        static QueueHandle_t debug_queue;
+
+    #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+
+    #if DEBUG_COMPRESS
+        /** @brief Number of hash bits used to find repeats */
+        #define DEBUG_COMPRESS_HASH_BITS 8
+
+        /** @brief State of a compressed sink, see debugAddCompressedSink */
+        typedef struct {
+            /** The last DEBUG_COMPRESS_WINDOW bytes given to the sink */
+            uint8_t window[DEBUG_COMPRESS_WINDOW];
+            /** Low 16 bits of the last position of each hash of 3 bytes */
+            uint16_t heads[1 << DEBUG_COMPRESS_HASH_BITS];
+            /** Number of bytes given to the sink since the last reset */
+            uint32_t position;
+            /** Records to write before the next reset */
+            uint16_t countdown;
+        } debug_compressor_t;
+    #endif /* DEBUG_COMPRESS */
+
+    /** @brief An output sink, see debugAddSink */
+    typedef struct {
+        /** Per-character output, or NULL for a bulk sink */
+        void (*send_func)(char);
+        /** Bulk output, or NULL for a per-character sink */
+        void (*write_func)(const char*, size_t);
+        /** Debug level of the sink */
+        uint8_t level;
+        /** Output buffers, one is filled while the other is written out */
+        char buffers[2][DEBUG_SINK_BUFFER_LENGTH];
+        /** Index of the output buffer being filled */
+        uint8_t active;
+        /** Number of characters in the output buffer being filled */
+        size_t length;
+        /** Given when write_func has finished with its buffer */
+        SemaphoreHandle_t done;
+        #if configSUPPORT_STATIC_ALLOCATION
+            /** Control block of done */
+            StaticSemaphore_t done_buffer;
+        #endif /* configSUPPORT_STATIC_ALLOCATION */
+        #if DEBUG_ITM
+            /** Set for the ITM sink, which has no output functions */
+            bool itm;
+        #endif /* DEBUG_ITM */
+        #if DEBUG_COMPRESS
+            /** Compressor of the sink, or NULL if it is not compressed */
+            debug_compressor_t* compressor;
+        #endif /* DEBUG_COMPRESS */
+    } debug_sink_t;
+
+    /** @brief The sinks, the first is the one passed to debugInitialise */
+    static debug_sink_t debug_sinks[DEBUG_SINK_COUNT] DEBUG_SINK_BUFFER_ATTR;
+
+    /** @brief Number of sinks that have been added */
+    static uint8_t debug_sink_count;
+
+    #if DEBUG_COMPRESS
+        /** @brief Compressors for debugAddCompressedSink */
+        static debug_compressor_t debug_compressors[DEBUG_COMPRESS_SINKS]
+                                                        DEBUG_SINK_BUFFER_ATTR;
+
+        /** @brief Number of compressors that have been given to sinks */
+        static uint8_t debug_compressors_used;
+
+        /**
+         * @brief Buffer a record is compressed into. The worst case is a
+         * reset point, then literal runs split after every two 0xFF bytes,
+         * which turns 2 bytes into 3.
+         */
+        static char debug_compressed[sizeof(DEBUG_COMPRESS_RESET) - 1 +
+                        DEBUG_RECORD_LENGTH + DEBUG_RECORD_LENGTH / 2 + 1];
+    #endif /* DEBUG_COMPRESS */
+
+    /** @brief Buffer each output record is rendered into */
+    static char debug_record[DEBUG_RECORD_LENGTH];
+
+    /** @brief Number of characters in debug_record */
+    static size_t debug_record_length;
+
+    /** @brief Set when a busy sink was left with output to flush */
+    static bool debug_output_pending;
+
+    /** @brief Set once records go to the panic output instead of the sinks */
+    static bool debug_panicking;
+
+    #if DEBUG_CRASH_LOG
+        /** @brief Marks a crash log that was written by this library */
+        #define DEBUG_CRASH_LOG_MAGIC 0xDEB6C0DEu
+
+        /**
+         * @brief Size of the header of each record in the crash log: type
+         * and length, then with DEBUG_FRAMED the full timestamp.
+         */
+        #if DEBUG_FRAMED
+            #define DEBUG_CRASH_LOG_HEADER 7
+        #else
+            #define DEBUG_CRASH_LOG_HEADER 3
+        #endif /* DEBUG_FRAMED */
+
+        /**
+         * @brief Records most recently output, kept over a reset by
+         * DEBUG_CRASH_LOG_ATTR and output again on the next boot.
+         */
+        static struct {
+            /** DEBUG_CRASH_LOG_MAGIC if the log is in use */
+            uint32_t magic;
+            /** Offset the next record is written to */
+            uint32_t head;
+            /** Offset of the oldest record */
+            uint32_t tail;
+            /** debug_crash_log_crc of the fields above */
+            uint32_t crc;
+            /** Records, see debug_crash_log_append */
+            uint8_t data[DEBUG_CRASH_LOG_LENGTH];
+        } debug_crash_log DEBUG_CRASH_LOG_ATTR;
+
+        /** @brief Set when the crash log of the last boot is to be output */
+        static bool debug_crash_log_found;
+
+        /** @brief Set while the crash log is output, so it is not appended */
+        static bool debug_crash_log_replaying;
+
+        #if DEBUG_FRAMED
+            /** @brief Full timestamp of the last record frame encoded */
+            static uint32_t debug_crash_log_timestamp;
+        #endif /* DEBUG_FRAMED */
+    #endif /* DEBUG_CRASH_LOG */
+
+#endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+
+/**
+ * @brief Function pointer for the debug hardware initialisation function.
+ */
+static void (*global_init_func)(void);
+
+/**
+ * @brief Function pointer for the system reset function.
+ */
+static void (*global_reset_func)(void);
+
+/**
+ * @brief Function pointer for the blocking character write used once the
+ * system has failed, see debug_config_t.
+ */
+static void (*global_panic_func)(char);
+
+/*----------------------------- Private Functions ----------------------------*/
+
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+
+    /**
+     * @brief Internal function used to allocate memory for the error string.
+     * @param debug_type level of debugging (handled by preprocessor).
+     *
+     * @retval true if message should be logged, false if not.
+     */
+    bool debug_check_level(char debug_type) {
+        return DEBUG_TYPE_ENABLED(debug_type);
+    }
+
+    #if DEBUG_RATE_LIMIT
+
+        /**
+         * @brief Log how many messages of a call site the rate limit
+         * suppressed, ahead of the next one that is let through.
+         * @param debug_type debug message type of the call site.
+         * @param count number of suppressed messages.
+         * @param from_isr true if called from an interrupt.
+         */
+        static void debug_report_suppressed(char debug_type, uint32_t count,
+                                                                bool from_isr)
+        {
+            #if DEBUG_MODE == DEBUG_MODE_TEXT
+                if(!from_isr) {
+                    debug_send_formatted(debug_type,
+                                "%u repeats suppressed", (unsigned)count);
+                    return;
+                }
+            #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+            #if DEBUG_RECORD_ARGS
+                debug_t debug = {
+                    .type = debug_type,
+                    .format = DEBUG_SITE_FORMAT(0, DEBUG_MODULE_DEFAULT,
+                                                    "%u repeats suppressed"),
+                    .arg_count = 1,
+                    .args = { count }
+                };
+                #if DEBUG_ISR
+                    if(from_isr) {
+                        debug_send_message_from_isr(debug);
+                        return;
+                    }
+                #endif /* DEBUG_ISR */
+                debug_send_message(debug);
+            #endif /* DEBUG_RECORD_ARGS */
+            (void)(from_isr);
+        }
+
+        /**
+         * @brief Internal function used to apply the rate limit of a call
+         * site. The bucket is only refilled once it is empty, so a call that
+         * is suppressed costs a tick read, a compare and an increment. Call
+         * sites shared by several tasks count approximately.
+         * @param rate token bucket of the call site.
+         * @param debug_type debug message type - see Debug Types.
+         * @param from_isr true if called from an interrupt.
+         *
+         * @retval true if the message should be logged.
+         */
+        bool debug_rate_limit(debug_rate_t* rate, char debug_type,
+                                                                bool from_isr)
+        {
+            if(rate->spent >= DEBUG_RATE_BURST) {
+                TickType_t now = from_isr ? xTaskGetTickCountFromISR() :
+                                                        xTaskGetTickCount();
+                TickType_t earned = (now - rate->refilled) / DEBUG_RATE_PERIOD;
+                if(earned == 0) {
+                    rate->suppressed++;
+                    return false;
+                }
+                rate->spent = (earned >= rate->spent) ? 0 :
+                                                    rate->spent - earned;
+                rate->refilled += earned * DEBUG_RATE_PERIOD;
+            } else if(rate->spent == 0) {
+                /* Earning starts from the first message of a full bucket */
+                rate->refilled = from_isr ? xTaskGetTickCountFromISR() :
+                                                        xTaskGetTickCount();
+            }
+            rate->spent++;
+            if(rate->suppressed != 0) {
+                debug_report_suppressed(debug_type, rate->suppressed,
+                                                                    from_isr);
+                rate->suppressed = 0;
+            }
+            return true;
+        }
+
+    #endif /* DEBUG_RATE_LIMIT */
+
+    /**
+     * @brief Index of a debug type in debug_drops.
+     * @param debug_type debug message type - see Debug Types.
+     *
+     * @retval index, with anything unknown counted as info.
+     */
+    static uint8_t debug_drop_index(char debug_type)
+    {
+        switch(debug_type) {
+            case DEBUG_TYPE_ERROR:
+                return 0;
+            case DEBUG_TYPE_WARNING:
+                return 1;
+            default:
+                return 2;
+        }
+    }
+
+    /**
+     * @brief Count a dropped message, to be reported once there is space.
+     * @param debug_type debug message type - see Debug Types.
+     * @param from_isr true if called from an interrupt.
+     */
+    static void debug_count_drop(char debug_type, bool from_isr)
+    {
+        UBaseType_t saved = 0;
+        if(from_isr) {
+            saved = taskENTER_CRITICAL_FROM_ISR();
+        } else {
+            taskENTER_CRITICAL();
+        }
+        debug_drops[debug_drop_index(debug_type)]++;
+        debug_drops_pending++;
+        if(from_isr) {
+            taskEXIT_CRITICAL_FROM_ISR(saved);
+        } else {
+            taskEXIT_CRITICAL();
+        }
+    }
+
+    #if DEBUG_MODE == DEBUG_MODE_TEXT
+
+        /**
+         * @brief Internal function used to allocate memory for the message
+         * string.
+         * @param length length of the message string, including the null
+         * terminator.
+         *
+         * @retval pointer to the string, or NULL if no memory is available.
+         */
+        char* debug_alloc_message(size_t length)
+        {
+            #if DEBUG_STORAGE == DEBUG_STORAGE_POOL
+                /* Every block is the same size, the caller truncates to it */
+                (void)(length);
+                taskENTER_CRITICAL();
+                debug_block_t* block = debug_pool_free;
+                if(block != NULL) {
+                    debug_pool_free = block->next;
+                } else {
+                    debug_pool_failures++;
+                }
+                taskEXIT_CRITICAL();
+                return (char*)block;
+            #else
+                return pvPortMalloc(length);
+            #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+        }
+
+        /**
+         * @brief Internal function used to free the memory of a message
+         * string.
+         * @param message string allocated with debug_alloc_message.
+         */
+        void debug_free_message(char* message)
+        {
+            #if DEBUG_STORAGE == DEBUG_STORAGE_POOL
+                debug_block_t* block = (debug_block_t*)message;
+                taskENTER_CRITICAL();
+                block->next = debug_pool_free;
+                debug_pool_free = block;
+                taskEXIT_CRITICAL();
+            #else
+                vPortFree(message);
+            #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+        }
+
+    #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+
+    #if DEBUG_MODE != DEBUG_MODE_BINARY
+
+        /**
+         * @brief Format a message into a buffer, replacing its end with
+         * DEBUG_TRUNCATION_MARKER if it does not fit.
+         * @param buffer buffer to format into.
+         * @param size size of the buffer.
+         * @param format printf-style format string.
+         * @param args arguments for the format string.
+         *
+         * @retval length of the formatted message, excluding the null
+         * terminator.
+         */
+        static size_t debug_format(char* buffer, size_t size,
+                                            const char* format, va_list args)
+        {
+            int length = vsnprintf(buffer, size, format, args);
+            if(length < 0) {
+                buffer[0] = '\0';
+                return 0;
+            }
+            if((size_t)length >= size) {
+                const size_t marker = sizeof(DEBUG_TRUNCATION_MARKER) - 1;
+                length = size - 1;
+                if(size > marker) {
+                    memcpy(&buffer[length - marker],
+                                            DEBUG_TRUNCATION_MARKER, marker);
+                }
+            }
+            return length;
+        }
+
+    #endif /* DEBUG_MODE != DEBUG_MODE_BINARY */
+
+    #if DEBUG_MODE == DEBUG_MODE_TEXT
+
+        /**
+         * @brief Internal function used to format a message once, straight
+         * into its storage, and add it to the queue.
+         * @param debug_type debug message type - see Debug Types.
+         * @param format printf-style format string, followed by its arguments.
+         */
+        void debug_send_formatted(char debug_type, const char* format, ...)
+        {
+            debug_t debug;
+            va_list args;
+            debug.type = debug_type;
+
+            #if DEBUG_STORAGE == DEBUG_STORAGE_POOL
+                /* Format directly into the pool block */
+                debug.message = debug_alloc_message(DEBUG_POOL_BLOCK_SIZE);
+                if(debug.message == NULL) {
+                    debug_count_drop(debug_type, false);
+                    return;
+                }
+                va_start(args, format);
+                debug_format(debug.message, DEBUG_POOL_BLOCK_SIZE, format,
+                                                                        args);
+                va_end(args);
+            #else
+                /* Format on the stack, then copy to an exactly sized string */
+                char buffer[DEBUG_MESSAGE_LENGTH];
+                va_start(args, format);
+                size_t length = debug_format(buffer, sizeof(buffer), format,
+                                                                        args);
+                va_end(args);
+                debug.message = debug_alloc_message(length + 1);
+                if(debug.message == NULL) {
+                    debug_count_drop(debug_type, false);
+                    return;
+                }
+                memcpy(debug.message, buffer, length + 1);
+            #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+
+            debug_send_message(debug);
+        }
+
+    #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+
+    /**
+     * @brief Read the clock selected by DEBUG_CLOCK.
+     * @param from_isr true if called from an interrupt.
+     *
+     * @retval timestamp for a message.
+     */
+    static uint32_t debug_timestamp(bool from_isr)
+    {
+        #if DEBUG_CLOCK == DEBUG_CLOCK_DWT
+            (void)(from_isr);
+            return dwt_read_cycle_counter();
+        #elif DEBUG_CLOCK == DEBUG_CLOCK_HOOK
+            (void)(from_isr);
+            return debugClockHook();
+        #else
+            return from_isr ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+        #endif /* DEBUG_CLOCK */
+    }
+
+    /**
+     * @brief Get the task ID of the calling task, giving it a free one the
+     * first time the task logs. IDs are only released by debugTaskDeleted, so
+     * DEBUG_TASK_COUNT must cover every task that logs at the same time.
+     *
+     * @retval task ID, or DEBUG_TASK_ID_NONE if all IDs are taken.
+     */
+    static uint8_t debug_task_id(void)
+    {
+        /* The ID is stored plus one, so that zero means unregistered */
+        #if DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TLS
+            uintptr_t slot = (uintptr_t)pvTaskGetThreadLocalStoragePointer(
+                                                    NULL, DEBUG_TLS_INDEX);
+            if(slot != 0) {
+                return (uint8_t)(slot - 1);
+            }
+        #elif DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_NUMBER
+            /* The task number functions ignore a NULL handle */
+            TaskHandle_t task = xTaskGetCurrentTaskHandle();
+            UBaseType_t slot = uxTaskGetTaskNumber(task);
+            if(slot != 0) {
+                return (uint8_t)(slot - 1);
+            }
+        #else
+            /* Handles are only written before the count is published */
+            TaskHandle_t task = xTaskGetCurrentTaskHandle();
+            UBaseType_t count = __atomic_load_n(&debug_tasks_registered,
+                                                            __ATOMIC_ACQUIRE);
+            for(UBaseType_t i = 0; i < count; i++) {
+                if(debug_task_handles[i] == task) {
+                    return (uint8_t)i;
+                }
+            }
+        #endif /* DEBUG_TASK_LOOKUP */
+
+        /* Tasks without an ID try again, as IDs may have been released */
+        if(__atomic_load_n(&debug_tasks_taken, __ATOMIC_RELAXED) ==
+                                                            DEBUG_TASK_COUNT) {
+            return DEBUG_TASK_ID_NONE;
+        }
+
+        uint8_t id = DEBUG_TASK_ID_NONE;
+        taskENTER_CRITICAL();
+        for(UBaseType_t i = 0; i < DEBUG_TASK_COUNT; i++) {
+            if(debug_task_states[i] == DEBUG_TASK_FREE) {
+                id = (uint8_t)i;
+                break;
+            }
+        }
+        if(id != DEBUG_TASK_ID_NONE) {
+            debug_task_states[id] = DEBUG_TASK_USED;
+            debug_tasks_taken++;
+            memcpy(debug_task_names[id], pcTaskGetName(NULL),
+                                                    configMAX_TASK_NAME_LEN);
+            #if DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TABLE
+                debug_task_handles[id] = task;
+            #endif /* DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TABLE */
+            #if DEBUG_MODE == DEBUG_MODE_BINARY
+                /* A reused ID has its new name sent again */
+                debug_names_unsent[id] = true;
+                __atomic_add_fetch(&debug_names_pending, 1, __ATOMIC_RELEASE);
+            #endif /* DEBUG_MODE == DEBUG_MODE_BINARY */
+            if(id >= debug_tasks_registered) {
+                __atomic_store_n(&debug_tasks_registered, id + 1,
+                                                            __ATOMIC_RELEASE);
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if(id != DEBUG_TASK_ID_NONE) {
+            #if DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TLS
+                vTaskSetThreadLocalStoragePointer(NULL, DEBUG_TLS_INDEX,
+                                                    (void*)((uintptr_t)id + 1));
+            #elif DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_NUMBER
+                vTaskSetTaskNumber(task, (UBaseType_t)id + 1);
+            #endif /* DEBUG_TASK_LOOKUP */
+        }
+        return id;
+    }
+
+    /**
+     * @brief Called by the debug task before it drains the output. IDs whose
+     * task was deleted before now can only have messages that this drain
+     * outputs, so they are marked to be released once it is empty.
+     */
+    static void debug_release_begin(void)
+    {
+        if(__atomic_load_n(&debug_tasks_deleted, __ATOMIC_ACQUIRE) == 0) {
+            return;
+        }
+        taskENTER_CRITICAL();
+        for(UBaseType_t i = 0; i < DEBUG_TASK_COUNT; i++) {
+            if(debug_task_states[i] == DEBUG_TASK_DELETED) {
+                debug_task_states[i] = DEBUG_TASK_RELEASING;
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    /**
+     * @brief Called by the debug task once the output has been drained, to
+     * release the IDs marked by debug_release_begin.
+     */
+    static void debug_release_end(void)
+    {
+        if(__atomic_load_n(&debug_tasks_deleted, __ATOMIC_ACQUIRE) == 0) {
+            return;
+        }
+        taskENTER_CRITICAL();
+        for(UBaseType_t i = 0; i < DEBUG_TASK_COUNT; i++) {
+            if(debug_task_states[i] == DEBUG_TASK_RELEASING) {
+                debug_task_states[i] = DEBUG_TASK_FREE;
+                debug_tasks_deleted--;
+                debug_tasks_taken--;
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING || \
+                                            DEBUG_DRAIN == DEBUG_DRAIN_BATCH
+
+        /**
+         * @brief Whether the debug task needs waking after a message has been
+         * added, see Drain Modes.
+         * @param waiting number of messages waiting, including the new one.
+         * @param debug_type type of the new message.
+         *
+         * @retval true if the debug task needs waking.
+         */
+        static bool debug_should_wake(UBaseType_t waiting, char debug_type)
+        {
+            #if DEBUG_DRAIN == DEBUG_DRAIN_BATCH
+                return waiting >= DEBUG_BATCH_THRESHOLD ||
+                                                debug_type == DEBUG_TYPE_ERROR;
+            #elif DEBUG_DRAIN == DEBUG_DRAIN_IDLE
+                (void)(waiting);
+                (void)(debug_type);
+                return false;
+            #else
+                /*
+                 * Only wake the debug task if the ring was empty, otherwise it
+                 * has yet to drain it anyway. DEBUG_RING_POLL_TICKS bounds the
+                 * delay if the two race.
+                 */
+                (void)(debug_type);
+                return waiting == 1;
+            #endif /* DEBUG_DRAIN */
+        }
+
+    #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING || BATCH */
+
+    #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+
+        /**
+         * @brief Number of free slots in a ring.
+         * @param ring ring of the calling task, may be NULL.
+         *
+         * @retval number of free slots.
+         */
+        static UBaseType_t debug_ring_spaces(debug_ring_t* ring)
+        {
+            if(ring == NULL) {
+                return 0;
+            }
+            uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            return DEBUG_RING_LENGTH - (ring->head - tail);
+        }
+
+        /**
+         * @brief Take the oldest message from a ring. With DROP_OLDEST the
+         * owning task may take messages too, so the tail is advanced with a
+         * compare-and-swap and a copy that lost the race is retried.
+         * @param ring ring to take the message from.
+         * @param debug message that is taken.
+         *
+         * @retval true if a message was taken, false if the ring is empty.
+         */
+        static bool debug_ring_pop(debug_ring_t* ring, debug_t* debug)
+        {
+            uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST
+                do {
+                    if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+                        return false;
+                    }
+                    *debug = ring->slots[tail & (DEBUG_RING_LENGTH - 1)];
+                } while(!__atomic_compare_exchange_n(&ring->tail, &tail,
+                                        tail + 1, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+            #else
+                if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+                    return false;
+                }
+                *debug = ring->slots[tail & (DEBUG_RING_LENGTH - 1)];
+                __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+            #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST */
+            return true;
+        }
+
+        /**
+         * @brief Add a message to a ring. Only called by the owning task (or
+         * with interrupts masked for the ISR ring) after checking there is
+         * space.
+         * @param ring ring to add the message to.
+         * @param debug message to add.
+         *
+         * @retval true if the debug task needs waking.
+         */
+        static bool debug_ring_push(debug_ring_t* ring, debug_t* debug)
+        {
+            uint32_t head = ring->head;
+            uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            ring->slots[head & (DEBUG_RING_LENGTH - 1)] = *debug;
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+            return debug_should_wake(head + 1 - tail, debug->type);
+        }
+
+        /**
+         * @brief Add a message to the ring of the calling task.
+         * @param ring ring of the calling task.
+         * @param debug message to add.
+         */
+        static void debug_ring_send(debug_ring_t* ring, debug_t* debug)
+        {
+            if(debug_ring_push(ring, debug)) {
+                xTaskNotifyGive(debug_task);
+            }
+        }
+
+        /**
+         * @brief Take the next message from the rings, visiting them
+         * round-robin so a busy task cannot starve the others.
+         * @param debug message that is taken.
+         *
+         * @retval true if a message was taken, false if all rings are empty.
+         */
+        static bool debug_ring_receive(debug_t* debug)
+        {
+            UBaseType_t claimed = __atomic_load_n(&debug_tasks_registered,
+                                                            __ATOMIC_ACQUIRE);
+            #if DEBUG_ISR
+                /* The ISR ring is visited after the task rings */
+                UBaseType_t count = claimed + 1;
+            #else
+                UBaseType_t count = claimed;
+            #endif /* DEBUG_ISR */
+            for(UBaseType_t i = 0; i < count; i++) {
+                UBaseType_t index = (debug_ring_next + i) % count;
+                #if DEBUG_ISR
+                    debug_ring_t* ring = (index == claimed) ? &debug_isr_ring :
+                                                        &debug_rings[index];
+                #else
+                    debug_ring_t* ring = &debug_rings[index];
+                #endif /* DEBUG_ISR */
+                if(debug_ring_pop(ring, debug)) {
+                    debug_ring_next = index + 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+
+    /**
+     * @brief Drop a message that could not be queued, releasing its storage.
+     * @param debug message to drop, never from an interrupt.
+     */
+    static void debug_discard(debug_t* debug)
+    {
+        #if DEBUG_MODE == DEBUG_MODE_TEXT
+            if(debug->message != NULL) {
+                debug_free_message(debug->message);
+            }
+        #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+        debug_count_drop(debug->type, false);
+    }
+
+    /**
+     * @brief Number of messages the calling task can queue without waiting.
+     * @param ring ring of the calling task (DEBUG_TRANSPORT_RING only).
+     *
+     * @retval number of free spaces.
+     */
+    static UBaseType_t debug_spaces(void* ring)
+    {
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+            return debug_ring_spaces(ring);
+        #else
+            (void)(ring);
+            return uxQueueSpacesAvailable(debug_queue);
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+    }
+
+    /**
+     * @brief Queue a message, applying DEBUG_OVERFLOW_POLICY if it is full.
+     * @param ring ring of the calling task (DEBUG_TRANSPORT_RING only).
+     * @param debug message to queue.
+     *
+     * @retval true if the message was queued, false if it must be dropped.
+     */
+    static bool debug_enqueue(void* ring, debug_t* debug)
+    {
+        #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS
+            TickType_t wait = (debug->type == DEBUG_TYPE_ERROR) ?
+                                                DEBUG_OVERFLOW_TIMEOUT : 0;
+        #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS */
+
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+            if(ring == NULL) {
+                return false;
+            }
+            #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST
+                debug_t oldest;
+                if(debug_ring_spaces(ring) == 0 &&
+                                            debug_ring_pop(ring, &oldest)) {
+                    debug_discard(&oldest);
+                }
+            #elif DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS
+                /* Only the debug task makes space, so poll for it */
+                TickType_t start = xTaskGetTickCount();
+                while(debug_ring_spaces(ring) == 0 &&
+                                        xTaskGetTickCount() - start < wait) {
+                    vTaskDelay(1);
+                }
+            #endif /* DEBUG_OVERFLOW_POLICY */
+            if(debug_ring_spaces(ring) == 0) {
+                return false;
+            }
+            debug_ring_send(ring, debug);
+            return true;
+        #else
+            (void)(ring);
+            #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST
+                bool queued = xQueueSend(debug_queue, debug, 0) == pdPASS;
+                if(!queued) {
+                    debug_t oldest;
+                    if(xQueueReceive(debug_queue, &oldest, 0) == pdPASS) {
+                        debug_discard(&oldest);
+                    }
+                    queued = xQueueSend(debug_queue, debug, 0) == pdPASS;
+                }
+            #elif DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS
+                bool queued = xQueueSend(debug_queue, debug, wait) == pdPASS;
+            #else
+                bool queued = xQueueSend(debug_queue, debug, 0) == pdPASS;
+            #endif /* DEBUG_OVERFLOW_POLICY */
+            #if DEBUG_DRAIN == DEBUG_DRAIN_BATCH
+                if(queued && debug_should_wake(
+                        uxQueueMessagesWaiting(debug_queue), debug->type)) {
+                    xTaskNotifyGive(debug_task);
+                }
+            #endif /* DEBUG_DRAIN == DEBUG_DRAIN_BATCH */
+            return queued;
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+    }
+
+    /**
+     * @brief Queue an "N messages dropped" error for the drops that have not
+     * been reported yet. If it cannot be queued they stay pending.
+     * @param ring ring of the calling task (DEBUG_TRANSPORT_RING only).
+     * @param timestamp timestamp of the report.
+     */
+    static void debug_report_drops(void* ring, uint32_t timestamp)
+    {
+        taskENTER_CRITICAL();
+        uint32_t dropped = debug_drops_pending;
+        debug_drops_pending = 0;
+        taskEXIT_CRITICAL();
+
+        debug_t report;
+        report.type = DEBUG_TYPE_ERROR;
+        report.timestamp = timestamp;
+        report.task_id = DEBUG_TASK_ID_DEBUG;
+        #if DEBUG_RECORD_ARGS
+            report.format = DEBUG_SITE_FORMAT(DEBUG_TYPE_ERROR,
+                            DEBUG_MODULE_DEFAULT, "%u messages dropped");
+            report.arg_count = 1;
+            report.args[0] = dropped;
+        #endif /* DEBUG_RECORD_ARGS */
+
+        bool queued = false;
+        #if DEBUG_MODE == DEBUG_MODE_TEXT
+            const size_t length = sizeof("4294967295 messages dropped");
+            report.message = debug_alloc_message(length);
+            if(report.message != NULL) {
+                snprintf(report.message, length, "%u messages dropped",
+                                                        (unsigned)dropped);
+                queued = debug_enqueue(ring, &report);
+                if(!queued) {
+                    debug_free_message(report.message);
+                }
+            }
+        #else
+            queued = debug_enqueue(ring, &report);
+        #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+
+        if(!queued) {
+            taskENTER_CRITICAL();
+            debug_drops_pending += dropped;
+            taskEXIT_CRITICAL();
+        }
+    }
+
     /**
-     * @brief This message is added to the queue if
-     * there is only one space left.
+     * @brief Internal function used add debug message to the queue.
+     * @param debug debug struct that is passed to the queue.
      */
-    static debug_t queue_full;
+    void debug_send_message(debug_t debug)
+    {
+        debug.timestamp = debug_timestamp(false);
+        debug.task_id = debug_task_id();
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+            debug_ring_t* ring = (debug.task_id < DEBUG_TASK_COUNT) ?
+                                            &debug_rings[debug.task_id] : NULL;
+        #else
+            void* ring = NULL;
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+
+        /* Report earlier drops first, so they show up where they happened */
+        if(__atomic_load_n(&debug_drops_pending, __ATOMIC_RELAXED) != 0 &&
+                                                    debug_spaces(ring) >= 2) {
+            debug_report_drops(ring, debug.timestamp);
+        }
+
+        if(!debug_enqueue(ring, &debug)) {
+            debug_discard(&debug);
+        }
+    }
+
+    #if DEBUG_ISR
+
+        /**
+         * @brief Number of the active interrupt.
+         *
+         * @retval IRQ number, negative for system exceptions.
+         */
+        static int16_t debug_current_irq(void)
+        {
+            /* IPSR only exists on M-profile cores, not Cortex-A or -R */
+            #if defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+                uint32_t ipsr;
+                __asm volatile ("mrs %0, ipsr" : "=r" (ipsr));
+                return (int16_t)(ipsr & 0x1FF) - 16;
+            #else
+                return 0;
+            #endif /* __ARM_ARCH_PROFILE == 'M' */
+        }
+
+        /**
+         * @brief Internal function used add debug message to the queue from
+         * an ISR. The message is dropped if there is no space.
+         * @param debug debug struct that is passed to the queue.
+         */
+        void debug_send_message_from_isr(debug_t debug)
+        {
+            BaseType_t higher_priority_task_woken = pdFALSE;
+            debug.timestamp = debug_timestamp(true);
+            debug.task_id = DEBUG_TASK_ID_ISR;
+            debug.irq = debug_current_irq();
+            #if DEBUG_MODE == DEBUG_MODE_TEXT
+                debug.message = NULL;
+            #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+
+            #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+                bool wake = false;
+                bool queued = false;
+                UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+                if(debug_ring_spaces(&debug_isr_ring) != 0) {
+                    wake = debug_ring_push(&debug_isr_ring, &debug);
+                    queued = true;
+                }
+                taskEXIT_CRITICAL_FROM_ISR(saved);
+                if(wake) {
+                    vTaskNotifyGiveFromISR(debug_task,
+                                                &higher_priority_task_woken);
+                }
+            #else
+                bool queued = xQueueSendFromISR(debug_queue, &debug,
+                                        &higher_priority_task_woken) == pdPASS;
+                #if DEBUG_DRAIN == DEBUG_DRAIN_BATCH
+                    if(queued && debug_should_wake(
+                                uxQueueMessagesWaitingFromISR(debug_queue),
+                                debug.type)) {
+                        vTaskNotifyGiveFromISR(debug_task,
+                                                &higher_priority_task_woken);
+                    }
+                #endif /* DEBUG_DRAIN == DEBUG_DRAIN_BATCH */
+            #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+            if(!queued) {
+                debug_count_drop(debug.type, true);
+            }
+            portYIELD_FROM_ISR(higher_priority_task_woken);
+        }
+
+    #endif /* DEBUG_ISR */
+
+    /**
+     * @brief Wait for the write_func of a sink to finish with its buffer.
+     * @param sink bulk sink to wait for.
+     * @param wait maximum time to wait.
+     *
+     * @retval true if the sink can be written to.
+     */
+    static bool debug_sink_take(debug_sink_t* sink, TickType_t wait)
+    {
+        #if DEBUG_DRAIN == DEBUG_DRAIN_IDLE
+            /* The idle task must never block, so poll for the write instead */
+            if(wait == portMAX_DELAY) {
+                while(xSemaphoreTake(sink->done, 0) != pdPASS) {
+                }
+                return true;
+            }
+        #endif /* DEBUG_DRAIN == DEBUG_DRAIN_IDLE */
+        return xSemaphoreTake(sink->done, wait) == pdPASS;
+    }
+
+    /**
+     * @brief Hand the filled output buffer of a bulk sink to its write_func
+     * once it has finished with the other one.
+     * @param sink sink to flush.
+     * @param wait maximum time to wait for the previous write.
+     *
+     * @retval true if nothing is left in the buffer.
+     */
+    static bool debug_sink_flush(debug_sink_t* sink, TickType_t wait)
+    {
+        if(sink->write_func == NULL || sink->length == 0) {
+            return true;
+        }
+        if(!debug_sink_take(sink, wait)) {
+            return false;
+        }
+        sink->write_func(sink->buffers[sink->active], sink->length);
+        sink->active ^= 1;
+        sink->length = 0;
+        return true;
+    }
+
+    /**
+     * @brief Flush every sink whose previous write has finished. A busy sink
+     * keeps its output buffered, so a slow sink does not hold up the others.
+     *
+     * @retval true if any sink still has buffered output.
+     */
+    static bool debug_flush(void)
+    {
+        bool pending = false;
+        uint8_t count = __atomic_load_n(&debug_sink_count, __ATOMIC_ACQUIRE);
+        for(uint8_t i = 0; i < count; i++) {
+            pending |= !debug_sink_flush(&debug_sinks[i], 0);
+        }
+        return pending;
+    }
+
+    /**
+     * @brief Internal function used to add a sink, see debugAddSink.
+     * @param send_func per-character output function, or NULL.
+     * @param write_func bulk output function, or NULL.
+     * @param level highest debug level written to the sink.
+     * @param compress true to give the sink a compressor (DEBUG_COMPRESS).
+     *
+     * @retval index of the sink, or -1 if it could not be added.
+     */
+    static int8_t debug_add_sink(void (*send_func)(char),
+                                void (*write_func)(const char*, size_t),
+                                uint8_t level, bool compress)
+    {
+        uint8_t index = debug_sink_count;
+        if(index >= DEBUG_SINK_COUNT ||
+                                    (send_func == NULL && write_func == NULL)) {
+            return -1;
+        }
+        debug_sink_t* sink = &debug_sinks[index];
+        #if DEBUG_COMPRESS
+            sink->compressor = NULL;
+            if(compress) {
+                if(debug_compressors_used >= DEBUG_COMPRESS_SINKS) {
+                    return -1;
+                }
+                sink->compressor = &debug_compressors[debug_compressors_used++];
+                memset(sink->compressor, 0, sizeof(debug_compressor_t));
+            }
+        #else
+            /* Suppresses unused variable warning */
+            (void)(compress);
+        #endif /* DEBUG_COMPRESS */
+        sink->send_func = send_func;
+        sink->write_func = write_func;
+        sink->level = level;
+        sink->active = 0;
+        sink->length = 0;
+        if(write_func != NULL) {
+            #if configSUPPORT_STATIC_ALLOCATION
+                sink->done = xSemaphoreCreateBinaryStatic(&sink->done_buffer);
+            #else
+                sink->done = xSemaphoreCreateBinary();
+            #endif /* configSUPPORT_STATIC_ALLOCATION */
+            /* The first write does not have to wait for a previous one */
+            xSemaphoreGive(sink->done);
+        }
+        #if DEBUG_ITM
+            sink->itm = false;
+        #endif /* DEBUG_ITM */
+        /* Publish the sink to the debug task only once it is complete */
+        __atomic_store_n(&debug_sink_count, index + 1, __ATOMIC_RELEASE);
+        return (int8_t)index;
+    }
+
+    #if DEBUG_ITM
+
+        /**
+         * @brief Write the rendered record to an ITM stimulus port, in 32-bit
+         * writes with byte writes for the last few characters.
+         * @param port stimulus port to write to.
+         */
+        static void debug_itm_write(uint8_t port)
+        {
+            /* Without a debugger attached the port would never be ready */
+            if(!DEBUG_ITM_ENABLED(port)) {
+                return;
+            }
+            size_t i = 0;
+            for(; i + 4 <= debug_record_length; i += 4) {
+                /* Little-endian, so the probe sees the bytes in order */
+                uint32_t word = (uint8_t)debug_record[i] |
+                                ((uint32_t)(uint8_t)debug_record[i + 1] << 8) |
+                                ((uint32_t)(uint8_t)debug_record[i + 2] << 16) |
+                                ((uint32_t)(uint8_t)debug_record[i + 3] << 24);
+                while(!DEBUG_ITM_READY(port)) {
+                }
+                DEBUG_ITM_WRITE(port, word, 4);
+            }
+            for(; i < debug_record_length; i++) {
+                while(!DEBUG_ITM_READY(port)) {
+                }
+                DEBUG_ITM_WRITE(port, (uint8_t)debug_record[i], 1);
+            }
+        }
+
+        /**
+         * @brief Write the rendered record to the ITM sink.
+         * @param sink ITM sink.
+         * @param debug_type type of the record, or 0 for a record that goes
+         * to the port of every type the sink takes.
+         */
+        static void debug_itm_emit(debug_sink_t* sink, char debug_type)
+        {
+            static const char types[] = {
+                DEBUG_TYPE_INFO, DEBUG_TYPE_WARNING, DEBUG_TYPE_ERROR
+            };
+            for(uint8_t i = 0; i < sizeof(types); i++) {
+                if((debug_type == 0 || debug_type == types[i]) &&
+                                    sink->level >= DEBUG_TYPE_LEVEL(types[i])) {
+                    debug_itm_write(DEBUG_ITM_PORT + i);
+                }
+            }
+        }
+
+    #endif /* DEBUG_ITM */
+
+    #if DEBUG_COMPRESS
+
+        /**
+         * @brief Hash the next three bytes, to find where they last occurred.
+         * @param data bytes to hash.
+         *
+         * @retval hash of DEBUG_COMPRESS_HASH_BITS bits.
+         */
+        static uint32_t debug_compress_hash(const uint8_t* data)
+        {
+            uint32_t bytes = data[0] | ((uint32_t)data[1] << 8) |
+                                                ((uint32_t)data[2] << 16);
+            return (bytes * 2654435761u) >> (32 - DEBUG_COMPRESS_HASH_BITS);
+        }
+
+        /**
+         * @brief Write a run of literal bytes to debug_compressed.
+         * @param size number of bytes in debug_compressed so far.
+         * @param data first byte of the run.
+         * @param count number of bytes, 1 to DEBUG_COMPRESS_MAX_LITERALS.
+         *
+         * @retval number of bytes in debug_compressed after the run.
+         */
+        static size_t debug_compress_literals(size_t size, const uint8_t* data,
+                                                                size_t count)
+        {
+            debug_compressed[size++] = (char)(count - 1);
+            memcpy(&debug_compressed[size], data, count);
+            return size + count;
+        }
+
+        /**
+         * @brief Compress the rendered record for one sink into
+         * debug_compressed. Only the last position of each hash is kept, so
+         * every byte costs a single comparison against the window.
+         * @param compressor compressor of the sink.
+         *
+         * @retval number of compressed bytes.
+         */
+        static size_t debug_compress(debug_compressor_t* compressor)
+        {
+            const uint8_t* data = (const uint8_t*)debug_record;
+            size_t length = debug_record_length;
+            size_t size = 0;
+            size_t literals = 0;
+            size_t i = 0;
+            if(compressor->countdown == 0) {
+                /* Nothing before the reset point can be referred to */
+                size = sizeof(DEBUG_COMPRESS_RESET) - 1;
+                memcpy(debug_compressed, DEBUG_COMPRESS_RESET, size);
+                memset(compressor->heads, 0, sizeof(compressor->heads));
+                compressor->position = 0;
+                compressor->countdown = DEBUG_COMPRESS_RESET_INTERVAL;
+            }
+            compressor->countdown--;
+            while(i < length) {
+                size_t match = 0;
+                uint32_t distance = 0;
+                if(i + DEBUG_COMPRESS_MIN_MATCH <= length) {
+                    uint32_t hash = debug_compress_hash(&data[i]);
+                    distance = (uint16_t)(compressor->position -
+                                                    compressor->heads[hash]);
+                    compressor->heads[hash] = (uint16_t)compressor->position;
+                    if(distance == 0 || distance > DEBUG_COMPRESS_WINDOW ||
+                                            distance > compressor->position) {
+                        distance = 0;
+                    }
+                }
+                /* A repeat can run on into the bytes it is repeating */
+                while(distance != 0 && i + match < length &&
+                                        match < DEBUG_COMPRESS_MAX_MATCH) {
+                    uint8_t earlier = (match < distance) ?
+                            compressor->window[(compressor->position -
+                            distance + match) % DEBUG_COMPRESS_WINDOW] :
+                            data[i + match - distance];
+                    if(earlier != data[i + match]) {
+                        break;
+                    }
+                    match++;
+                }
+
+                /* Three 0xFF bytes in a row would look like a reset point */
+                bool reset_like = literals >= 2 && data[i] == 0xFF &&
+                                data[i - 1] == 0xFF && data[i - 2] == 0xFF;
+                if(literals != 0 && (match >= DEBUG_COMPRESS_MIN_MATCH ||
+                                    literals == DEBUG_COMPRESS_MAX_LITERALS ||
+                                    reset_like)) {
+                    size = debug_compress_literals(size, &data[i - literals],
+                                                                    literals);
+                    literals = 0;
+                }
+                if(match < DEBUG_COMPRESS_MIN_MATCH) {
+                    match = 1;
+                    literals++;
+                } else {
+                    debug_compressed[size++] = (char)(DEBUG_COMPRESS_MATCH +
+                                            match - DEBUG_COMPRESS_MIN_MATCH);
+                    debug_compressed[size++] = (char)((distance - 1) & 0xFF);
+                    debug_compressed[size++] = (char)((distance - 1) >> 8);
+                }
+                for(size_t j = 0; j < match; j++) {
+                    /* Positions inside a repeat can start later repeats */
+                    if(j != 0 && i + DEBUG_COMPRESS_MIN_MATCH <= length) {
+                        compressor->heads[debug_compress_hash(&data[i])] =
+                                            (uint16_t)compressor->position;
+                    }
+                    compressor->window[compressor->position %
+                                        DEBUG_COMPRESS_WINDOW] = data[i++];
+                    compressor->position++;
+                }
+            }
+            if(literals != 0) {
+                size = debug_compress_literals(size, &data[i - literals],
+                                                                    literals);
+            }
+            return size;
+        }
+
+    #endif /* DEBUG_COMPRESS */
+
+    #if DEBUG_CRASH_LOG
+
+        /**
+         * @brief Update a CRC-32 (IEEE 802.3) with more data.
+         * @param crc CRC of the data so far, 0 to start.
+         * @param data data to add.
+         * @param length number of bytes.
+         *
+         * @retval updated CRC.
+         */
+        static uint32_t debug_crc32(uint32_t crc, const void* data,
+                                                                size_t length)
+        {
+            const uint8_t* bytes = data;
+            crc = ~crc;
+            for(size_t i = 0; i < length; i++) {
+                crc ^= bytes[i];
+                for(uint8_t bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+                }
+            }
+            return ~crc;
+        }
+
+        /**
+         * @brief Checksum of the crash log indices, so a log left by a
+         * power cycle or a reset in the middle of an update is not replayed.
+         *
+         * @retval checksum of the crash log header.
+         */
+        static uint32_t debug_crash_log_crc(void)
+        {
+            uint32_t header[3] = {
+                debug_crash_log.magic, debug_crash_log.head,
+                debug_crash_log.tail
+            };
+            return debug_crc32(0, header, sizeof(header));
+        }
+
+        /**
+         * @brief Copy bytes out of the crash log, wrapping at its end.
+         * @param offset offset of the first byte in the crash log.
+         * @param data buffer to copy to.
+         * @param length number of bytes.
+         *
+         * @retval offset of the byte after the last one copied.
+         */
+        static uint32_t debug_crash_log_read(uint32_t offset, void* data,
+                                                                size_t length)
+        {
+            uint8_t* bytes = data;
+            for(size_t i = 0; i < length; i++) {
+                bytes[i] = debug_crash_log.data[offset];
+                offset = (offset + 1) % DEBUG_CRASH_LOG_LENGTH;
+            }
+            return offset;
+        }
+
+        /**
+         * @brief Copy bytes into the crash log, wrapping at its end.
+         * @param offset offset of the first byte in the crash log.
+         * @param data bytes to copy.
+         * @param length number of bytes.
+         *
+         * @retval offset of the byte after the last one copied.
+         */
+        static uint32_t debug_crash_log_write(uint32_t offset,
+                                            const void* data, size_t length)
+        {
+            const uint8_t* bytes = data;
+            for(size_t i = 0; i < length; i++) {
+                debug_crash_log.data[offset] = bytes[i];
+                offset = (offset + 1) % DEBUG_CRASH_LOG_LENGTH;
+            }
+            return offset;
+        }
+
+        /**
+         * @brief Empty the crash log.
+         */
+        static void debug_crash_log_clear(void)
+        {
+            debug_crash_log.magic = DEBUG_CRASH_LOG_MAGIC;
+            debug_crash_log.head = 0;
+            debug_crash_log.tail = 0;
+            debug_crash_log.crc = debug_crash_log_crc();
+        }
+
+        /**
+         * @brief Copy the rendered record to the crash log, discarding the
+         * oldest records to make room for it. With DEBUG_FRAMED the payload
+         * is kept instead, as its timestamp may be a delta from a record
+         * that is discarded, see debug_crash_log_reframe.
+         * @param debug_type type of the record.
+         */
+        static void debug_crash_log_append(char debug_type)
+        {
+            #if DEBUG_FRAMED
+                const void* record = debug_frame_payload;
+                size_t length = debug_frame_length;
+            #else
+                const void* record = debug_record;
+                size_t length = debug_record_length;
+            #endif /* DEBUG_FRAMED */
+            /* Each entry is its header, then the record itself */
+            uint8_t header[DEBUG_CRASH_LOG_HEADER] = {
+                (uint8_t)debug_type, length & 0xFF, length >> 8
+            };
+            #if DEBUG_FRAMED
+                for(uint8_t i = 0; i < 4; i++) {
+                    header[3 + i] = (uint8_t)(debug_crash_log_timestamp >>
+                                                                    (8 * i));
+                }
+            #endif /* DEBUG_FRAMED */
+            size_t size = sizeof(header) + length;
+            if(debug_crash_log_replaying || size >= DEBUG_CRASH_LOG_LENGTH) {
+                return;
+            }
+            uint32_t head = debug_crash_log.head;
+            uint32_t tail = debug_crash_log.tail;
+            /* One byte is always left free, so head == tail means empty */
+            while((tail + DEBUG_CRASH_LOG_LENGTH - head - 1) %
+                                            DEBUG_CRASH_LOG_LENGTH < size) {
+                uint8_t oldest[DEBUG_CRASH_LOG_HEADER];
+                debug_crash_log_read(tail, oldest, sizeof(oldest));
+                tail = (tail + sizeof(oldest) + oldest[1] +
+                        ((uint32_t)oldest[2] << 8)) % DEBUG_CRASH_LOG_LENGTH;
+            }
+            head = debug_crash_log_write(head, header, sizeof(header));
+            head = debug_crash_log_write(head, record, length);
+            debug_crash_log.head = head;
+            debug_crash_log.tail = tail;
+            debug_crash_log.crc = debug_crash_log_crc();
+        }
+
+    #endif /* DEBUG_CRASH_LOG */
+
+    /**
+     * @brief Write the rendered record to the panic output, polling rather
+     * than using the sink buffers or anything else that might block.
+     * @param debug_type type of the record.
+     */
+    static void debug_panic_emit(char debug_type)
+    {
+        void (*send_func)(char) = global_panic_func;
+        const char* data = debug_record;
+        size_t length = debug_record_length;
+        if(send_func == NULL && debug_sink_count > 0) {
+            /* A bulk sink 0 cannot be polled, so it needs a panic_func */
+            configASSERT(debug_sinks[0].send_func != NULL);
+            send_func = debug_sinks[0].send_func;
+            #if DEBUG_COMPRESS
+                /* Keep the stream of the sink decodable */
+                if(debug_sinks[0].compressor != NULL) {
+                    data = debug_compressed;
+                    length = debug_compress(debug_sinks[0].compressor);
+                }
+            #endif /* DEBUG_COMPRESS */
+        }
+        if(send_func != NULL) {
+            for(size_t i = 0; i < length; i++) {
+                send_func(data[i]);
+            }
+        }
+        #if DEBUG_ITM
+            /* The ITM is polled anyway */
+            for(uint8_t i = 0; i < debug_sink_count; i++) {
+                if(debug_sinks[i].itm) {
+                    debug_itm_emit(&debug_sinks[i], debug_type);
+                }
+            }
+        #else
+            /* Suppresses unused variable warning */
+            (void)(debug_type);
+        #endif /* DEBUG_ITM */
+    }
+
+    /**
+     * @brief Copy the rendered record to every sink whose level enables it.
+     * @param debug_type type of the record, or 0 for records every sink gets.
+     */
+    static void debug_emit_record(char debug_type)
+    {
+        #if DEBUG_CRASH_LOG
+            debug_crash_log_append(debug_type);
+        #endif /* DEBUG_CRASH_LOG */
+        if(debug_panicking) {
+            debug_panic_emit(debug_type);
+            debug_record_length = 0;
+            return;
+        }
+        uint8_t count = __atomic_load_n(&debug_sink_count, __ATOMIC_ACQUIRE);
+        for(uint8_t i = 0; i < count; i++) {
+            debug_sink_t* sink = &debug_sinks[i];
+            if(debug_type != 0 && sink->level < DEBUG_TYPE_LEVEL(debug_type)) {
+                continue;
+            }
+            #if DEBUG_ITM
+                if(sink->itm) {
+                    debug_itm_emit(sink, debug_type);
+                    continue;
+                }
+            #endif /* DEBUG_ITM */
+            const char* data = debug_record;
+            size_t length = debug_record_length;
+            #if DEBUG_COMPRESS
+                if(sink->compressor != NULL) {
+                    data = debug_compressed;
+                    length = debug_compress(sink->compressor);
+                }
+            #endif /* DEBUG_COMPRESS */
+            if(sink->write_func == NULL) {
+                for(size_t j = 0; j < length; j++) {
+                    sink->send_func(data[j]);
+                }
+                continue;
+            }
+            size_t copied = 0;
+            while(copied < length) {
+                size_t space = DEBUG_SINK_BUFFER_LENGTH - sink->length;
+                size_t chunk = length - copied;
+                if(chunk > space) {
+                    chunk = space;
+                }
+                memcpy(&sink->buffers[sink->active][sink->length],
+                                                    &data[copied], chunk);
+                sink->length += chunk;
+                copied += chunk;
+                if(sink->length == DEBUG_SINK_BUFFER_LENGTH) {
+                    /* The buffer is full, so this sink has to be waited for */
+                    debug_sink_flush(sink, portMAX_DELAY);
+                }
+            }
+        }
+        debug_record_length = 0;
+    }
+
+    /**
+     * @brief Write one character to the record being rendered. Characters
+     * beyond DEBUG_RECORD_LENGTH are dropped.
+     * @param c character to write.
+     */
+    static void debug_write_char(char c)
+    {
+        if(debug_record_length < DEBUG_RECORD_LENGTH) {
+            debug_record[debug_record_length++] = c;
+        }
+    }
+
+    /**
+     * @brief Write a null-terminated string to the debug output.
+     * @param string string to write.
+     */
+    static void debug_write_string(const char* string)
+    {
+        while(*string != '\0') {
+            /* Print Character to debug console */
+            debug_write_char(*string);
+
+            string++;
+        }
+    }
+
+    #if DEBUG_MODE != DEBUG_MODE_BINARY
+
+        /**
+         * @brief Write an unsigned decimal number to the debug output.
+         * @param number number to write.
+         */
+        static void debug_write_number(uint32_t number)
+        {
+            char digits[10];
+            uint8_t count = 0;
+            do {
+                digits[count++] = (char)('0' + (number % 10));
+                number /= 10;
+            } while(number != 0);
+            while(count > 0) {
+                debug_write_char(digits[--count]);
+            }
+        }
+
+    #endif /* DEBUG_MODE != DEBUG_MODE_BINARY */
+
+    #if DEBUG_MODE != DEBUG_MODE_BINARY
+
+        /**
+         * @brief Write the name of the task or interrupt that sent a message.
+         * @param debug message whose source is written.
+         */
+        static void debug_write_source(debug_t* debug)
+        {
+            switch(debug->task_id) {
+                case DEBUG_TASK_ID_DEBUG:
+                    debug_write_string("debug");
+                    break;
+                case DEBUG_TASK_ID_NONE:
+                    debug_write_char('?');
+                    break;
+                #if DEBUG_ISR
+                    case DEBUG_TASK_ID_ISR:
+                        debug_write_string("IRQ");
+                        if(debug->irq < 0) {
+                            debug_write_char('-');
+                        }
+                        debug_write_number(abs(debug->irq));
+                        break;
+                #endif /* DEBUG_ISR */
+                default:
+                    debug_write_string(debug_task_names[debug->task_id]);
+                    break;
+            }
+        }
+
+    #endif /* DEBUG_MODE != DEBUG_MODE_BINARY */
+
+    #if DEBUG_MODE == DEBUG_MODE_BINARY
+
+        #if DEBUG_SITES
+            /** @brief Bounds of the call site descriptors, set by the linker */
+            extern const debug_site_t __start_debug_sites[];
+            extern const debug_site_t __stop_debug_sites[];
+        #endif /* DEBUG_SITES */
+
+        #if !DEBUG_FRAMED
+
+            /**
+             * @brief Write a 32-bit word to the debug output, little-endian.
+             * @param word word to write.
+             */
+            static void debug_write_word(uint32_t word)
+            {
+                for(uint8_t i = 0; i < 4; i++) {
+                    debug_write_char((char)(word & 0xFF));
+                    word >>= 8;
+                }
+            }
+
+        #endif /* !DEBUG_FRAMED */
+
+        #if DEBUG_FRAMED
+
+            /**
+             * @brief Write a varint, 7 bits per byte with the least
+             * significant first and the top bit set on all but the last.
+             * @param value value to write.
+             */
+            static void debug_write_varint(uint32_t value)
+            {
+                while(value >= 0x80) {
+                    debug_write_char((char)(value | 0x80));
+                    value >>= 7;
+                }
+                debug_write_char((char)value);
+            }
+
+            /**
+             * @brief Write a signed value as a zigzag varint, so values
+             * close to zero are short either side of it.
+             * @param value value to write.
+             */
+            static void debug_write_zigzag(int32_t value)
+            {
+                debug_write_varint(((uint32_t)value << 1) ^
+                                                    (uint32_t)(value >> 31));
+            }
+
+            /**
+             * @brief Update a CRC-16/CCITT (0x1021, initial value 0xFFFF).
+             * @param data data to add.
+             * @param length number of bytes.
+             *
+             * @retval CRC of the data.
+             */
+            static uint16_t debug_crc16(const uint8_t* data, size_t length)
+            {
+                uint16_t crc = 0xFFFF;
+                for(size_t i = 0; i < length; i++) {
+                    crc ^= (uint16_t)data[i] << 8;
+                    for(uint8_t bit = 0; bit < 8; bit++) {
+                        crc = (crc << 1) ^ ((crc & 0x8000) ? 0x1021 : 0);
+                    }
+                }
+                return crc;
+            }
+
+            /**
+             * @brief Turn the payload written to the record into a frame:
+             * append its CRC, COBS encode it and add the delimiter.
+             */
+            static void debug_write_frame(void)
+            {
+                uint16_t crc = debug_crc16((const uint8_t*)debug_record,
+                                                        debug_record_length);
+                debug_write_char((char)(crc & 0xFF));
+                debug_write_char((char)(crc >> 8));
+                size_t length = debug_record_length;
+                memcpy(debug_frame_payload, debug_record, length);
+                debug_frame_length = length;
+                debug_record_length = 0;
+
+                /* Each code byte is one more than the bytes before a zero */
+                size_t code = 0;
+                debug_write_char(1);
+                for(size_t i = 0; i < length; i++) {
+                    if(debug_frame_payload[i] == 0) {
+                        code = debug_record_length;
+                        debug_write_char(1);
+                        continue;
+                    }
+                    debug_write_char((char)debug_frame_payload[i]);
+                    if(code < DEBUG_RECORD_LENGTH &&
+                                    ++debug_record[code] == (char)0xFF &&
+                                    i + 1 < length) {
+                        code = debug_record_length;
+                        debug_write_char(1);
+                    }
+                }
+                debug_write_char(0);
+            }
+
+        #endif /* DEBUG_FRAMED */
+
+        /**
+         * @brief Send the names of the tasks that have been given an ID since
+         * the last call, so the host can resolve the task IDs of records.
+         */
+        static void debug_write_names(void)
+        {
+            if(__atomic_load_n(&debug_names_pending, __ATOMIC_ACQUIRE) == 0) {
+                return;
+            }
+            UBaseType_t registered = __atomic_load_n(&debug_tasks_registered,
+                                                            __ATOMIC_ACQUIRE);
+            for(UBaseType_t id = 0; id < registered; id++) {
+                if(!__atomic_load_n(&debug_names_unsent[id],
+                                                        __ATOMIC_ACQUIRE)) {
+                    continue;
+                }
+                __atomic_store_n(&debug_names_unsent[id], false,
+                                                        __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&debug_names_pending, 1, __ATOMIC_RELAXED);
+                #if DEBUG_FRAMED
+                    debug_write_char(DEBUG_BINARY_NAME);
+                    debug_write_char((char)id);
+                    debug_write_string(debug_task_names[id]);
+                    debug_write_frame();
+                #else
+                    debug_write_char((char)DEBUG_BINARY_SYNC);
+                    debug_write_char(DEBUG_BINARY_NAME);
+                    debug_write_char((char)id);
+                    debug_write_string(debug_task_names[id]);
+                    debug_write_char('\0');
+                #endif /* DEBUG_FRAMED */
+                /* Every sink needs the names to decode its records */
+                debug_emit_record(0);
+            }
+        }
+
+        #if DEBUG_FRAMED
+
+            #if DEBUG_CRASH_LOG
+                /**
+                 * @brief Give the next record of every type a full timestamp.
+                 */
+                static void debug_frame_resync(void)
+                {
+                    for(uint8_t i = 0; i < DEBUG_FRAME_CHAINS; i++) {
+                        debug_frame_deltas[i] = DEBUG_FRAME_SYNC_INTERVAL;
+                    }
+                }
+            #endif /* DEBUG_CRASH_LOG */
+
+            /**
+             * @brief Write the type and timestamp that start a record frame,
+             * the timestamp as a delta from the chain of the type unless the
+             * chain is due a full one.
+             * @param type debug type, with DEBUG_FRAME_SITE if needed.
+             * @param timestamp timestamp of the record.
+             */
+            static void debug_write_frame_start(uint8_t type,
+                                                        uint32_t timestamp)
+            {
+                uint8_t chain = DEBUG_TYPE_LEVEL((char)(type &
+                                        ~DEBUG_FRAME_SITE)) - DEBUG_ERRORS;
+                bool absolute = (debug_frame_deltas[chain] >=
+                                                DEBUG_FRAME_SYNC_INTERVAL);
+                if(absolute) {
+                    type |= DEBUG_FRAME_ABSOLUTE;
+                }
+                debug_write_char((char)type);
+                if(absolute) {
+                    debug_write_varint(timestamp);
+                } else {
+                    /* Records from different rings can be out of order */
+                    debug_write_zigzag((int32_t)(timestamp -
+                                                debug_frame_timestamps[chain]));
+                }
+                /*
+                 * Sinks at this level or a more verbose one get the record.
+                 * Every record ages every chain, so rare types still get a
+                 * full timestamp soon after a lost frame.
+                 */
+                for(uint8_t i = 0; i < DEBUG_FRAME_CHAINS; i++) {
+                    if(i >= chain) {
+                        debug_frame_timestamps[i] = timestamp;
+                    }
+                    if(absolute && i >= chain) {
+                        debug_frame_deltas[i] = 0;
+                    } else if(debug_frame_deltas[i] <
+                                                DEBUG_FRAME_SYNC_INTERVAL) {
+                        debug_frame_deltas[i]++;
+                    }
+                }
+                #if DEBUG_CRASH_LOG
+                    debug_crash_log_timestamp = timestamp;
+                #endif /* DEBUG_CRASH_LOG */
+            }
+
+            /**
+             * @brief Write a debug message as a frame, see DEBUG_FRAMED.
+             * @param debug message to write.
+             */
+            static void debug_write_message(debug_t* debug)
+            {
+                debug_write_names();
+                uint8_t type = (uint8_t)debug->type;
+                #if DEBUG_SITES
+                    type |= DEBUG_FRAME_SITE;
+                #endif /* DEBUG_SITES */
+                debug_write_frame_start(type, debug->timestamp);
+                debug_write_char((char)debug->task_id);
+                #if DEBUG_ISR
+                    if(debug->task_id == DEBUG_TASK_ID_ISR) {
+                        debug_write_zigzag(debug->irq);
+                    }
+                #endif /* DEBUG_ISR */
+                #if DEBUG_SITES
+                    debug_write_varint(debug->format - __start_debug_sites);
+                #else
+                    debug_write_varint((uint32_t)DEBUG_WORD(debug->format));
+                #endif /* DEBUG_SITES */
+                for(uint8_t i = 0; i < debug->arg_count; i++) {
+                    debug_write_zigzag((int32_t)debug->args[i]);
+                }
+                debug_write_frame();
+            }
+
+        #else
+
+            /**
+             * @brief Write a debug message as a raw binary record.
+             * @param debug message to write.
+             */
+            static void debug_write_message(debug_t* debug)
+            {
+                debug_write_names();
+                #if DEBUG_SITES
+                    debug_write_char((char)DEBUG_BINARY_SITE_SYNC);
+                #else
+                    debug_write_char((char)DEBUG_BINARY_SYNC);
+                #endif /* DEBUG_SITES */
+                debug_write_char(debug->type);
+                debug_write_word(debug->timestamp);
+                debug_write_char((char)debug->task_id);
+                #if DEBUG_ISR
+                    if(debug->task_id == DEBUG_TASK_ID_ISR) {
+                        debug_write_char((char)(debug->irq & 0xFF));
+                        debug_write_char((char)((uint16_t)debug->irq >> 8));
+                    }
+                #endif /* DEBUG_ISR */
+                #if DEBUG_SITES
+                    uint16_t site = debug->format - __start_debug_sites;
+                    debug_write_char((char)(site & 0xFF));
+                    debug_write_char((char)(site >> 8));
+                #else
+                    debug_write_word((uint32_t)DEBUG_WORD(debug->format));
+                #endif /* DEBUG_SITES */
+                debug_write_char((char)debug->arg_count);
+                for(uint8_t i = 0; i < debug->arg_count; i++) {
+                    debug_write_word((uint32_t)debug->args[i]);
+                }
+            }
+
+        #endif /* DEBUG_FRAMED */
+
+    #else
+
+        #if DEBUG_RECORD_ARGS
+            /** @brief Buffer that deferred messages are formatted into */
+            static char debug_render_buffer[DEBUG_RENDER_LENGTH];
+
+            /**
+             * @brief Format a deferred message into debug_render_buffer.
+             * @param debug message to format.
+             * @param ... the argument words of the message.
+             */
+            static void debug_render_args(debug_t* debug, ...)
+            {
+                va_list args;
+                va_start(args, debug);
+                debug_format(debug_render_buffer, sizeof(debug_render_buffer),
+                                    DEBUG_FORMAT_STRING(debug->format), args);
+                va_end(args);
+            }
+
+            /**
+             * @brief Format a deferred message into debug_render_buffer.
+             * @param debug message to format.
+             */
+            static void debug_render_message(debug_t* debug)
+            {
+                /* Unused argument words are zero and ignored by vsnprintf */
+                debug_word_t a[8] = {0};
+                memcpy(a, debug->args, debug->arg_count * sizeof(a[0]));
+                debug_render_args(debug, a[0], a[1], a[2], a[3], a[4], a[5],
+                                                                a[6], a[7]);
+            }
+        #endif /* DEBUG_RECORD_ARGS */
+
+        /**
+         * @brief Write a debug message as a line of text.
+         * @param debug message to write.
+         */
+        static void debug_write_message(debug_t* debug)
+        {
+            /* Print timestamp, debug type and calling task */
+            debug_write_number(debug->timestamp);
+            debug_write_char(' ');
+            debug_write_char(debug->type);
+            debug_write_string(" - ");
+            debug_write_source(debug);
+            debug_write_string(" - ");
+
+            /* Write out message */
+            #if DEBUG_MODE == DEBUG_MODE_TEXT && DEBUG_ISR
+                /* Messages from interrupts are not formatted yet */
+                if(debug->message == NULL) {
+                    debug_render_message(debug);
+                    debug_write_string(debug_render_buffer);
+                } else {
+                    debug_write_string(debug->message);
+                }
+            #elif DEBUG_MODE == DEBUG_MODE_TEXT
+                debug_write_string(debug->message);
+            #else
+                debug_render_message(debug);
+                debug_write_string(debug_render_buffer);
+            #endif /* DEBUG_MODE == DEBUG_MODE_TEXT && DEBUG_ISR */
+            /* Keep the line ending of a record that was cut short */
+            if(debug_record_length == DEBUG_RECORD_LENGTH) {
+                debug_record_length--;
+            }
+            debug_write_char('\n');
+        }
+
+    #endif /* DEBUG_MODE == DEBUG_MODE_BINARY */
+
+    /**
+     * @brief Write a message to the sinks and release its storage. The
+     * output is not flushed, see debug_drain_batch.
+     * @param debug message to output.
+     */
+    static void debug_output_message(debug_t* debug)
+    {
+        debug_write_message(debug);
+        debug_emit_record(debug->type);
+
+        #if DEBUG_MODE == DEBUG_MODE_TEXT
+            /* Free the memory allocated to the message string */
+            if(debug->message != NULL) {
+                debug_free_message(debug->message);
+            }
+        #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+    }
+
+    #if DEBUG_CRASH_LOG
+
+        /**
+         * @brief Check the crash log left by the last boot, and empty it if
+         * it is not valid.
+         */
+        static void debug_crash_log_check(void)
+        {
+            uint32_t head = debug_crash_log.head;
+            uint32_t offset = debug_crash_log.tail;
+            bool valid = debug_crash_log.magic == DEBUG_CRASH_LOG_MAGIC &&
+                                debug_crash_log.crc == debug_crash_log_crc() &&
+                                head < DEBUG_CRASH_LOG_LENGTH &&
+                                offset < DEBUG_CRASH_LOG_LENGTH;
+            /* Every record must lie within the log and fit in debug_record */
+            while(valid && offset != head) {
+                uint8_t header[DEBUG_CRASH_LOG_HEADER];
+                uint32_t used = (head + DEBUG_CRASH_LOG_LENGTH - offset) %
+                                                        DEBUG_CRASH_LOG_LENGTH;
+                debug_crash_log_read(offset, header, sizeof(header));
+                size_t length = header[1] | ((size_t)header[2] << 8);
+                valid = used >= sizeof(header) + length &&
+                                                length <= DEBUG_RECORD_LENGTH;
+                offset = (offset + sizeof(header) + length) %
+                                                        DEBUG_CRASH_LOG_LENGTH;
+            }
+            debug_crash_log_found = valid && head != debug_crash_log.tail;
+            if(!valid) {
+                debug_crash_log_clear();
+            }
+        }
 
-    /** @brief The queue itself */
-    static QueueHandle_t debug_queue;
+        #if DEBUG_FRAMED
 
-#endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+            /**
+             * @brief Frame a payload from the crash log again. The timestamp
+             * of a record is written again from the full one kept with it,
+             * as the one it was sent with may be a delta from a record that
+             * was discarded from the log or is not being replayed.
+             * @param length length of the payload in debug_frame_payload,
+             * with its CRC.
+             * @param timestamp full timestamp of the record.
+             *
+             * @retval false if the payload was corrupted in the log.
+             */
+            static bool debug_crash_log_reframe(size_t length,
+                                                        uint32_t timestamp)
+            {
+                /* It must not be sent on with a new, valid CRC */
+                if(length < 3 || debug_crc16(debug_frame_payload, length - 2) !=
+                                (debug_frame_payload[length - 2] |
+                                (debug_frame_payload[length - 1] << 8))) {
+                    return false;
+                }
+                size_t start = 0;
+                if(debug_frame_payload[0] != DEBUG_BINARY_NAME) {
+                    /* Skip the type and the varint timestamp */
+                    start = 1;
+                    while(start < length &&
+                                    (debug_frame_payload[start++] & 0x80)) {
+                    }
+                    debug_write_frame_start(debug_frame_payload[0] &
+                                            ~DEBUG_FRAME_ABSOLUTE, timestamp);
+                }
+                /* debug_write_frame appends a new CRC */
+                for(size_t i = start; i + 2 < length; i++) {
+                    debug_write_char((char)debug_frame_payload[i]);
+                }
+                debug_write_frame();
+                return true;
+            }
 
-/**
- * @brief Function pointer for the debug hardware initialisation function.
- */
-static void (*global_init_func)(void);
+        #endif /* DEBUG_FRAMED */
 
-/**
- * @brief Function pointer for actual debug character write.
- * This is a global variable as a function pointer cannot easily
- * be passed to a task.
- */
-static void (*global_send_func)(char);
+        /**
+         * @brief Output every record in the crash log, without adding them
+         * to it again.
+         */
+        static void debug_crash_log_output(void)
+        {
+            debug_crash_log_replaying = true;
+            #if DEBUG_FRAMED
+                /* The output may be read by a host that has no chains yet */
+                debug_frame_resync();
+            #endif /* DEBUG_FRAMED */
+            uint32_t offset = debug_crash_log.tail;
+            while(offset != debug_crash_log.head) {
+                uint8_t header[DEBUG_CRASH_LOG_HEADER];
+                offset = debug_crash_log_read(offset, header, sizeof(header));
+                size_t length = header[1] | ((size_t)header[2] << 8);
+                #if DEBUG_FRAMED
+                    offset = debug_crash_log_read(offset, debug_frame_payload,
+                                                                    length);
+                    if(!debug_crash_log_reframe(length, header[3] |
+                                        ((uint32_t)header[4] << 8) |
+                                        ((uint32_t)header[5] << 16) |
+                                        ((uint32_t)header[6] << 24))) {
+                        continue;
+                    }
+                #else
+                    debug_record_length = length;
+                    offset = debug_crash_log_read(offset, debug_record,
+                                                                    length);
+                #endif /* DEBUG_FRAMED */
+                debug_emit_record((char)header[0]);
+            }
+            debug_crash_log_replaying = false;
+        }
 
-/**
- * @brief Function pointer for the system reset function.
- */
-static void (*global_reset_func)(void);
+        /**
+         * @brief Output the marker before or after the records of the
+         * previous boot to every sink.
+         * @param marker DEBUG_BOOT_PREVIOUS or DEBUG_BOOT_CURRENT.
+         */
+        static void debug_crash_log_marker(uint8_t marker)
+        {
+            #if DEBUG_FRAMED
+                debug_write_char(DEBUG_BINARY_BOOT);
+                debug_write_char((char)marker);
+                debug_write_frame();
+                /* The host starts every chain again at the marker */
+                debug_frame_resync();
+            #elif DEBUG_MODE == DEBUG_MODE_BINARY
+                debug_write_char((char)DEBUG_BINARY_SYNC);
+                debug_write_char(DEBUG_BINARY_BOOT);
+                debug_write_char((char)marker);
+            #else
+                debug_write_string((marker == DEBUG_BOOT_PREVIOUS) ?
+                                            "--- previous boot ---\n" :
+                                            "--- end of previous boot ---\n");
+            #endif /* DEBUG_FRAMED */
+            debug_emit_record(0);
+        }
 
-/*----------------------------- Private Functions ----------------------------*/
+        /**
+         * @brief Output the records in the crash log of the last boot to
+         * every sink, then empty it.
+         */
+        static void debug_crash_log_replay(void)
+        {
+            /* Appending the marker could discard the oldest record */
+            debug_crash_log_replaying = true;
+            debug_crash_log_marker(DEBUG_BOOT_PREVIOUS);
+            debug_crash_log_output();
+            debug_crash_log_marker(DEBUG_BOOT_CURRENT);
+            debug_crash_log_clear();
+        }
 
-#if DEBUG_LEVEL >= DEBUG_ERRORS
+    #endif /* DEBUG_CRASH_LOG */
 
     /**
-     * @brief Internal function used to allocate memory for the error string.
-     * @param debug_type level of debugging (handled by preprocessor).
+     * @brief Initialise the output, from the task that drains the messages.
+     */
+    static void debug_start(void)
+    {
+        global_init_func();
+        #if DEBUG_CRASH_LOG
+            if(debug_crash_log_found) {
+                debug_crash_log_replay();
+            }
+        #endif /* DEBUG_CRASH_LOG */
+    }
+
+    /**
+     * @brief Take the next waiting message.
+     * @param debug message that is taken.
+     * @param wait time to wait for a message (DEBUG_TRANSPORT_QUEUE only).
      *
-     * @retval true if message should be logged, false if not.
+     * @retval true if a message was taken.
      */
-    bool debug_check_level(char debug_type) {
-        switch(debug_type) {
-            #if DEBUG_LEVEL >= DEBUG_FULL
-                case DEBUG_TYPE_INFO:
-            #endif /* DEBUG_LEVEL >= DEBUG_FULL */
-            #if DEBUG_LEVEL >= DEBUG_WARNINGS
-                case DEBUG_TYPE_WARNING:
-            #endif /* DEBUG_LEVEL >= DEBUG_WARNINGS */
-            case DEBUG_TYPE_ERROR:
-                return true;
-            default:
-                return false;
-        }
+    static bool debug_receive(debug_t* debug, TickType_t wait)
+    {
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+            (void)(wait);
+            return debug_ring_receive(debug);
+        #else
+            return xQueueReceive(debug_queue, debug, wait) == pdPASS;
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
     }
 
     /**
-     * @brief Internal function used add debug message to the queue.
-     * @param debug_type debug message type - see Debug Types.
-     * @param length length of message passed in printf-style message.
+     * @brief Switch the output over to the panic output, and output the most
+     * recent records again.
+     * @param history output the crash log if there is one. Otherwise only
+     * what the bulk sinks have not written out yet is output.
      */
-    void debug_send_message(debug_t debug)
+    static void debug_panic_begin(bool history)
     {
-        switch(uxQueueSpacesAvailable(debug_queue)) {
-            case 0:
-                break;
-            case 1:
-                {
-                    debug.task_handle = debug_task;
-                    char full_message[] = "Queue Full!\n";
-                    queue_full.message = pvPortMalloc(sizeof(full_message));
-                    xQueueSend(debug_queue, &queue_full, 0);
-                    break;
+        debug_panicking = true;
+        /* Discard a record the debug task may have been rendering */
+        debug_record_length = 0;
+        #if DEBUG_CRASH_LOG
+            if(history) {
+                debug_crash_log_output();
+                return;
+            }
+        #else
+            /* Suppresses unused variable warning */
+            (void)(history);
+        #endif /* DEBUG_CRASH_LOG */
+        for(uint8_t i = 0; i < debug_sink_count; i++) {
+            debug_sink_t* sink = &debug_sinks[i];
+            if(sink->write_func == NULL) {
+                continue;
+            }
+            #if DEBUG_COMPRESS
+                /* Compressed output can only be decoded in its own stream */
+                if(sink->compressor != NULL) {
+                    continue;
                 }
-            default:
-                debug.task_handle = xTaskGetCurrentTaskHandle();
-                xQueueSend(debug_queue, &debug, 0);
-                break;
+            #endif /* DEBUG_COMPRESS */
+            for(size_t j = 0; j < sink->length; j++) {
+                debug_write_char(sink->buffers[sink->active][j]);
+                if(debug_record_length == DEBUG_RECORD_LENGTH) {
+                    debug_panic_emit(0);
+                    debug_record_length = 0;
+                }
+            }
+            debug_panic_emit(0);
+            debug_record_length = 0;
         }
     }
 
     /**
-     * @brief Task that handles actually sending the messages in a multi-threaded
-     * environment.
-     * @param args unused.
+     * @brief Output a fatal message synchronously, along with every message
+     * still waiting to be output, then reset.
+     * @param debug message, with its type and content filled in.
      */
-    static void debug_handler(void *args __attribute((unused)))
+    static void __attribute__((noreturn)) debug_panic(debug_t* debug)
     {
-        /*
-         * Calling the initialisation function here ensures the scheduler is
-         * running in case an interrupt fires immediately.
-         */
-        global_init_func();
+        debug->timestamp = debug_timestamp(false);
+        debug->task_id = debug_task_id();
+        /* Nests, unlike portDISABLE_INTERRUPTS, so the queue can be used */
+        taskENTER_CRITICAL();
+        debug_panic_begin(false);
+        debug_t debug_next;
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_QUEUE
+            if(debug_queue != NULL)
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_QUEUE */
+        {
+            while(debug_receive(&debug_next, 0)) {
+                debug_write_message(&debug_next);
+                debug_emit_record(debug_next.type);
+            }
+        }
+        debug_write_message(debug);
+        debug_emit_record(debug->type);
+        if(global_reset_func != NULL) {
+            global_reset_func();
+        }
         for(;;) {
-            /* Block until there is an item in the queue */
-            debug_t debug_next;
-            xQueueReceive(debug_queue, &debug_next, portMAX_DELAY);
-
-            /* Print debug type and calling task */
-            global_send_func(debug_next.type);
-            global_send_func(' ');
-            global_send_func('-');
-            global_send_func(' ');
-            char* task_ptr = pcTaskGetName(debug_next.task_handle);
-            while(*task_ptr != '\0') {
-                /* Print Character to debug console */
-                global_send_func(*task_ptr);
-
-                task_ptr++;
-            }
-            global_send_func(' ');
-            global_send_func('-');
-            global_send_func(' ');
+        }
+    }
 
-            /* Write out message */
-            char* message_ptr = debug_next.message;
-            while(*message_ptr != '\0') {
-                /* Print Character to debug console */
-                global_send_func(*message_ptr);
+    #if DEBUG_MODE == DEBUG_MODE_TEXT
 
-                message_ptr++;
-            }
-            global_send_func('\n');
+        /**
+         * @brief Internal function used to format a fatal message into a
+         * static buffer and output it synchronously, see DEBUG_PANIC.
+         * @param format printf-style format string, followed by its arguments.
+         */
+        void debug_panic_formatted(const char* format, ...)
+        {
+            static char buffer[DEBUG_MESSAGE_LENGTH];
+            debug_t debug = { .type = DEBUG_TYPE_ERROR, .message = buffer };
+            va_list args;
+            va_start(args, format);
+            debug_format(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            debug_panic(&debug);
+        }
 
-            /* Free the memory allocated to the message string */
-            vPortFree(message_ptr);
+    #else
+
+        /**
+         * @brief Internal function used to output a fatal message
+         * synchronously, see DEBUG_PANIC.
+         * @param debug debug struct with the format and arguments.
+         */
+        void debug_panic_message(debug_t debug)
+        {
+            debug_panic(&debug);
+        }
+
+    #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+
+    #if DEBUG_FAULT
+
+        /** @brief Format of a fault record, see debug_panic_record */
+        #define DEBUG_FAULT_FORMAT(format) \
+            DEBUG_SITE_FORMAT(DEBUG_TYPE_ERROR, DEBUG_MODULE_DEFAULT, format)
+
+        /**
+         * @brief Output an error record from the debug handler itself,
+         * without the heap or the message queue.
+         * @param format format of the record, see DEBUG_FAULT_FORMAT.
+         * @param arg_count number of arguments, at most DEBUG_MAX_ARGS.
+         * @param ... 32-bit arguments for the format string.
+         */
+        static void debug_panic_record(debug_format_t format,
+                                                    uint8_t arg_count, ...)
+        {
+            debug_t debug = {
+                .type = DEBUG_TYPE_ERROR,
+                .timestamp = debug_timestamp(true),
+                .task_id = DEBUG_TASK_ID_DEBUG
+            };
+            va_list args;
+            va_start(args, arg_count);
+            #if DEBUG_MODE == DEBUG_MODE_TEXT
+                static char buffer[DEBUG_RENDER_LENGTH];
+                (void)(arg_count);
+                debug_format(buffer, sizeof(buffer), format, args);
+                debug.message = buffer;
+            #else
+                debug.format = format;
+                debug.arg_count = arg_count;
+                for(uint8_t i = 0; i < arg_count; i++) {
+                    debug.args[i] = va_arg(args, uint32_t);
+                }
+            #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+            va_end(args);
+            debug_write_message(&debug);
+            debug_emit_record(debug.type);
+        }
+
+    #endif /* DEBUG_FAULT */
+
+    /**
+     * @brief Output up to DEBUG_DRAIN_LIMIT waiting messages, then flush the
+     * output once for all of them.
+     * @param wait time to wait for the first message (DEBUG_TRANSPORT_QUEUE
+     * only).
+     *
+     * @retval number of messages output.
+     */
+    static UBaseType_t debug_drain_batch(TickType_t wait)
+    {
+        debug_t debug_next;
+        UBaseType_t count = 0;
+        debug_release_begin();
+        while(count < DEBUG_DRAIN_LIMIT &&
+                        debug_receive(&debug_next, (count == 0) ? wait : 0)) {
+            debug_output_message(&debug_next);
+            count++;
+        }
+        debug_output_pending = debug_flush();
+        if(count < DEBUG_DRAIN_LIMIT) {
+            /* Nothing is left, so neither are the messages of deleted tasks */
+            debug_release_end();
         }
+        return count;
     }
+
+    #if DEBUG_DRAIN != DEBUG_DRAIN_TASK || \
+                                    DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+
+        /**
+         * @brief Output every message that is waiting, in batches.
+         */
+        static void debug_drain(void)
+        {
+            while(debug_drain_batch(0) == DEBUG_DRAIN_LIMIT) {
+            }
+        }
+
+    #endif /* DEBUG_DRAIN != DEBUG_DRAIN_TASK || RING */
+
+    #if DEBUG_DRAIN != DEBUG_DRAIN_IDLE
+
+        /**
+         * @brief Task that handles actually sending the messages in a
+         * multi-threaded environment.
+         * @param args unused.
+         */
+        static void debug_handler(void *args __attribute((unused)))
+        {
+            /*
+             * Calling the initialisation function here ensures the scheduler is
+             * running in case an interrupt fires immediately.
+             */
+            debug_start();
+            for(;;) {
+                #if DEBUG_DRAIN == DEBUG_DRAIN_BATCH
+                    /* Sleep until a batch is ready, then drain everything */
+                    ulTaskNotifyTake(pdTRUE, DEBUG_BATCH_TIMEOUT);
+                    debug_drain();
+                #elif DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+                    /* Block until a task signals its ring, then drain all */
+                    ulTaskNotifyTake(pdTRUE, DEBUG_RING_POLL_TICKS);
+                    debug_drain();
+                #else
+                    /*
+                     * Block until there is an item in the queue, or retry
+                     * soon if a busy sink still has output buffered
+                     */
+                    debug_drain_batch(debug_output_pending ?
+                                    DEBUG_SINK_RETRY_TICKS : portMAX_DELAY);
+                #endif /* DEBUG_DRAIN == DEBUG_DRAIN_BATCH */
+            }
+        }
+
+    #endif /* DEBUG_DRAIN != DEBUG_DRAIN_IDLE */
 #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
 
 /*------------------------------ Public Functions ----------------------------*/
@@ -152,7 +2486,8 @@ static void (*global_reset_func)(void);
  * @brief Initialise the queues and tasks associated with the debug handler.
  * @param queue_length defines the length of the message queue. While the a long
  * message queue does not use up much memory, the dynamically allocated message
- * strings that the queue items point to do. Keep as low as possible.
+ * strings that the queue items point to do. Keep as low as possible. Unused
+ * with DEBUG_TRANSPORT_RING, see DEBUG_RING_LENGTH.
  * @param init_func function pointer to a function that initialises the output
  * means that send_func uses to do the logging.
  * @param send_func function pointer to a function that sends one char in a
@@ -163,27 +2498,381 @@ static void (*global_reset_func)(void);
  */
 TaskHandle_t* debugInitialise(size_t queue_length, void (*init_func)(void),
                             void (*send_func)(char), void (*reset_func)(void))
+{
+    debug_config_t config = DEBUG_CONFIG_DEFAULT;
+    config.queue_length = queue_length;
+    config.init_func = init_func;
+    config.send_func = send_func;
+    config.reset_func = reset_func;
+    return debugInitialiseWithConfig(&config);
+}
+
+/**
+ * @brief Initialise the debug handler with a bulk write function in place of
+ * a per-character send function.
+ * @param queue_length see debugInitialise.
+ * @param init_func see debugInitialise.
+ * @param write_func function pointer to a function that starts writing a
+ * buffer of the given length, e.g. by DMA. The buffer stays valid until
+ * debugWriteComplete or debugWriteCompleteFromISR is called.
+ * @param reset_func see debugInitialise.
+ *
+ * @retval pointer to handle of the task that was created to handle debugging.
+ */
+TaskHandle_t* debugInitialiseBulk(size_t queue_length, void (*init_func)(void),
+                            void (*write_func)(const char*, size_t),
+                            void (*reset_func)(void))
+{
+    debug_config_t config = DEBUG_CONFIG_DEFAULT;
+    config.queue_length = queue_length;
+    config.init_func = init_func;
+    config.write_func = write_func;
+    config.reset_func = reset_func;
+    return debugInitialiseWithConfig(&config);
+}
+
+/**
+ * @brief Initialise the debug handler from a configuration. With static
+ * buffers for the task and queue, DEBUG_STORAGE_POOL (or a deferred mode) and
+ * configSUPPORT_STATIC_ALLOCATION, nothing is allocated from the heap. With
+ * configSUPPORT_DYNAMIC_ALLOCATION 0 those buffers are required.
+ * @param config configuration, only read during the call.
+ *
+ * @retval pointer to handle of the task that was created to handle debugging.
+ */
+TaskHandle_t* debugInitialiseWithConfig(const debug_config_t* config)
 {
     /* Call passed initialisation function and assign the fptrs */
-    global_init_func = init_func;
-    global_send_func = send_func;
-    global_reset_func = reset_func;
+    global_init_func = config->init_func;
+    global_reset_func = config->reset_func;
+    global_panic_func = config->panic_func;
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+
+        #if DEBUG_CLOCK == DEBUG_CLOCK_DWT
+            /* Start the cycle counter used for timestamps */
+            dwt_enable_cycle_counter();
+        #endif /* DEBUG_CLOCK == DEBUG_CLOCK_DWT */
+
+        #if DEBUG_SITES && DEBUG_MODE == DEBUG_MODE_BINARY && !DEBUG_FRAMED
+            /* Unframed records hold a 2-byte site index */
+            configASSERT(__stop_debug_sites - __start_debug_sites <=
+                                                        DEBUG_SITES_MAX_RAW);
+        #endif /* DEBUG_SITES && !DEBUG_FRAMED */
+
+        /* The sink passed in becomes sink 0, at the compiled-in level */
+        debugAddSink(config->send_func, config->write_func, DEBUG_LEVEL);
+
+        #if DEBUG_CRASH_LOG
+            /* The records are output once debug_start has run */
+            debug_crash_log_check();
+        #endif /* DEBUG_CRASH_LOG */
+
+        bool static_queue = false;
+        bool static_task = false;
+        #if configSUPPORT_STATIC_ALLOCATION
+            static_queue = config->queue_storage != NULL &&
+                                                config->queue_buffer != NULL;
+            static_task = config->task_stack != NULL &&
+                                                config->task_buffer != NULL;
+        #endif /* configSUPPORT_STATIC_ALLOCATION */
+
+        #if DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING
+            /* The rings are statically allocated */
+            (void)(static_queue);
+        #else
+            /* Initialise message queue */
+            if(static_queue) {
+                #if configSUPPORT_STATIC_ALLOCATION
+                    debug_queue = xQueueCreateStatic(config->queue_length,
+                                        sizeof(debug_t), config->queue_storage,
+                                        config->queue_buffer);
+                #endif /* configSUPPORT_STATIC_ALLOCATION */
+            } else {
+                #if configSUPPORT_DYNAMIC_ALLOCATION
+                    debug_queue = xQueueCreate(config->queue_length,
+                                                            sizeof(debug_t));
+                #else
+                    /* Without a heap the config must supply the buffers */
+                    configASSERT(static_queue);
+                #endif /* configSUPPORT_DYNAMIC_ALLOCATION */
+            }
+        #endif /* DEBUG_TRANSPORT == DEBUG_TRANSPORT_RING */
+
+        #if DEBUG_DRAIN == DEBUG_DRAIN_IDLE
+            /* debugIdleHook does the work of the debug task */
+            (void)(static_task);
+        #else
+            /* Create debug task and pass handle back to the user application */
+            if(static_task) {
+                #if configSUPPORT_STATIC_ALLOCATION
+                    debug_task = xTaskCreateStatic(debug_handler, "debug",
+                                config->stack_depth, NULL, config->priority,
+                                config->task_stack, config->task_buffer);
+                #endif /* configSUPPORT_STATIC_ALLOCATION */
+            } else {
+                #if configSUPPORT_DYNAMIC_ALLOCATION
+                    xTaskCreate(debug_handler, "debug", config->stack_depth,
+                                        NULL, config->priority, &debug_task);
+                #else
+                    /* Without a heap the config must supply the buffers */
+                    configASSERT(static_task);
+                #endif /* configSUPPORT_DYNAMIC_ALLOCATION */
+            }
+        #endif /* DEBUG_DRAIN == DEBUG_DRAIN_IDLE */
+
+        #if DEBUG_MODE == DEBUG_MODE_TEXT && DEBUG_STORAGE == DEBUG_STORAGE_POOL
+            /* Thread every block of the message pool onto the free list */
+            debug_pool_free = NULL;
+            for(size_t i = DEBUG_POOL_BLOCK_COUNT; i > 0; i--) {
+                debug_pool[i - 1].next = debug_pool_free;
+                debug_pool_free = &debug_pool[i - 1];
+            }
+        #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+    return &debug_task;
+}
+
+/**
+ * @brief Add an output sink. Every record is rendered once and copied to each
+ * sink whose level enables its type, so e.g. a slow UART can take only errors
+ * while a fast bulk sink takes everything. Sinks cannot be removed, and should
+ * be added from one task at a time.
+ * @param send_func per-character output function, or NULL.
+ * @param write_func bulk output function, see debugInitialiseBulk. Used in
+ * place of send_func if set.
+ * @param level highest debug level (DEBUG_ERRORS to DEBUG_FULL) written to the
+ * sink. Levels above DEBUG_LEVEL have no effect.
+ *
+ * @retval index of the sink, for debugSinkWriteComplete, or -1 if
+ * DEBUG_SINK_COUNT sinks have been added already.
+ */
+int8_t debugAddSink(void (*send_func)(char),
+                        void (*write_func)(const char*, size_t), uint8_t level)
+{
     #if DEBUG_LEVEL >= DEBUG_ERRORS
+        return debug_add_sink(send_func, write_func, level, false);
+    #else
+        /* Suppresses unused variable warnings */
+        (void)(send_func);
+        (void)(write_func);
+        (void)(level);
+        return -1;
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+}
 
-        /* Initialise message queue */
-        debug_queue = xQueueCreate(queue_length, sizeof(debug_t));
+/**
+ * @brief Add an output sink whose output is compressed, see DEBUG_COMPRESS.
+ * Each compressed sink has its own window of earlier output, so the
+ * templates of repeated messages shrink to a few bytes. Its output can only
+ * be decoded from the start of the stream, e.g. with debug-decode -z.
+ * @param send_func per-character output function, or NULL.
+ * @param write_func bulk output function, or NULL.
+ * @param level highest debug level written to the sink.
+ *
+ * @retval index of the sink, or -1 if DEBUG_SINK_COUNT sinks or
+ * DEBUG_COMPRESS_SINKS compressed sinks have been added already.
+ */
+int8_t debugAddCompressedSink(void (*send_func)(char),
+                        void (*write_func)(const char*, size_t), uint8_t level)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_COMPRESS
+        return debug_add_sink(send_func, write_func, level, true);
+    #else
+        /* Suppresses unused variable warnings */
+        (void)(send_func);
+        (void)(write_func);
+        (void)(level);
+        return -1;
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_COMPRESS */
+}
 
-        /* Create debug task and pass handle back to the user application */
-        xTaskCreate(debug_handler, "debug", 350, NULL, 1, &debug_task);
+/**
+ * @brief Add a sink that writes records to the ITM stimulus ports. Info,
+ * warning and error records go to DEBUG_ITM_PORT and the two ports after it,
+ * in 32-bit writes. Ports that are not enabled are skipped.
+ * @param level highest debug level written to the sink.
+ *
+ * @retval index of the sink, or -1 if DEBUG_SINK_COUNT sinks have been added
+ * already.
+ */
+int8_t debugAddItmSink(uint8_t level)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_ITM
+        uint8_t index = debug_sink_count;
+        if(index >= DEBUG_SINK_COUNT) {
+            return -1;
+        }
+        debug_sink_t* sink = &debug_sinks[index];
+        sink->send_func = NULL;
+        sink->write_func = NULL;
+        sink->level = level;
+        sink->length = 0;
+        sink->itm = true;
+        #if DEBUG_COMPRESS
+            sink->compressor = NULL;
+        #endif /* DEBUG_COMPRESS */
+        /* Publish the sink to the debug task only once it is complete */
+        __atomic_store_n(&debug_sink_count, index + 1, __ATOMIC_RELEASE);
+        return (int8_t)index;
+    #else
+        /* Suppresses unused variable warning */
+        (void)(level);
+        return -1;
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_ITM */
+}
 
-        /* Populate 'Queue Full' message partially */
-        queue_full.type = DEBUG_TYPE_ERROR;
-        queue_full.task_handle = debug_task;
+/**
+ * @brief Signal that the buffer passed to the write_func of a sink has been
+ * written out.
+ * @param sink index returned by debugAddSink.
+ */
+void debugSinkWriteComplete(uint8_t sink)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        if(sink < DEBUG_SINK_COUNT && debug_sinks[sink].done != NULL) {
+            xSemaphoreGive(debug_sinks[sink].done);
+        }
     #else
         /* Suppresses unused variable warning */
-        (void)(queue_length);
+        (void)(sink);
     #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
-    return &debug_task;
+}
+
+/**
+ * @brief Signal from an interrupt that the buffer passed to the write_func of
+ * a sink has been written out.
+ * @param sink index returned by debugAddSink.
+ * @param higher_priority_task_woken set to pdTRUE if a context switch should
+ * be requested before the interrupt exits.
+ */
+void debugSinkWriteCompleteFromISR(uint8_t sink,
+                                    BaseType_t* higher_priority_task_woken)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        if(sink < DEBUG_SINK_COUNT && debug_sinks[sink].done != NULL) {
+            xSemaphoreGiveFromISR(debug_sinks[sink].done,
+                                                higher_priority_task_woken);
+        }
+    #else
+        /* Suppresses unused variable warnings */
+        (void)(sink);
+        (void)(higher_priority_task_woken);
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+}
+
+/**
+ * @brief Signal that the buffer passed to write_func has been written out.
+ */
+void debugWriteComplete(void)
+{
+    debugSinkWriteComplete(0);
+}
+
+/**
+ * @brief Signal from an interrupt that the buffer passed to write_func has
+ * been written out.
+ * @param higher_priority_task_woken set to pdTRUE if a context switch should
+ * be requested before the interrupt exits.
+ */
+void debugWriteCompleteFromISR(BaseType_t* higher_priority_task_woken)
+{
+    debugSinkWriteCompleteFromISR(0, higher_priority_task_woken);
+}
+
+/**
+ * @brief Number of messages that were discarded because the message pool
+ * (DEBUG_STORAGE_POOL) was empty.
+ *
+ * @retval number of failed allocations since initialisation.
+ */
+uint32_t debugGetPoolFailures(void)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_MODE == DEBUG_MODE_TEXT && \
+                                        DEBUG_STORAGE == DEBUG_STORAGE_POOL
+        return debug_pool_failures;
+    #else
+        return 0;
+    #endif /* DEBUG_STORAGE == DEBUG_STORAGE_POOL */
+}
+
+/**
+ * @brief Number of messages of a type that were dropped, whether because the
+ * queue was full or because no memory was available for them.
+ * @param debug_type debug message type - see Debug Types.
+ *
+ * @retval number of dropped messages since initialisation.
+ */
+uint32_t debugGetDropCount(char debug_type)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        return debug_drops[debug_drop_index(debug_type)];
+    #else
+        /* Suppresses unused variable warning */
+        (void)(debug_type);
+        return 0;
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+}
+
+/**
+ * @brief Release the task ID of a task that is being deleted. The ID is only
+ * given out again once every message the task left behind has been output,
+ * and in binary mode the name of the new task is then sent again.
+ * @param task task being deleted, or NULL for the calling task.
+ */
+void debugTaskDeleted(TaskHandle_t task)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        if(task == NULL) {
+            task = xTaskGetCurrentTaskHandle();
+        }
+        UBaseType_t id = DEBUG_TASK_COUNT;
+        taskENTER_CRITICAL();
+        #if DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_TLS
+            id = (UBaseType_t)(uintptr_t)pvTaskGetThreadLocalStoragePointer(
+                                                    task, DEBUG_TLS_INDEX) - 1;
+            vTaskSetThreadLocalStoragePointer(task, DEBUG_TLS_INDEX, NULL);
+        #elif DEBUG_TASK_LOOKUP == DEBUG_TASK_LOOKUP_NUMBER
+            id = uxTaskGetTaskNumber(task) - 1;
+            vTaskSetTaskNumber(task, 0);
+        #else
+            for(UBaseType_t i = 0; i < debug_tasks_registered; i++) {
+                if(debug_task_handles[i] == task) {
+                    /* A task given the same handle must not find this ID */
+                    debug_task_handles[i] = NULL;
+                    id = i;
+                    break;
+                }
+            }
+        #endif /* DEBUG_TASK_LOOKUP */
+        /* Tasks that never logged have no ID, which wraps past the count */
+        if(id < DEBUG_TASK_COUNT &&
+                                debug_task_states[id] == DEBUG_TASK_USED) {
+            debug_task_states[id] = DEBUG_TASK_DELETED;
+            debug_tasks_deleted++;
+        }
+        taskEXIT_CRITICAL();
+    #else
+        /* Suppresses unused variable warning */
+        (void)(task);
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+}
+
+/**
+ * @brief Output every waiting message. With DEBUG_DRAIN_IDLE this must be
+ * called from vApplicationIdleHook, and nowhere else. It does nothing in the
+ * other drain modes.
+ */
+void debugIdleHook(void)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS && DEBUG_DRAIN == DEBUG_DRAIN_IDLE
+        /* The output is initialised on the first call, as by debug_handler */
+        static bool initialised = false;
+        if(!initialised) {
+            debug_start();
+            initialised = true;
+        }
+        debug_drain();
+    #endif /* DEBUG_DRAIN == DEBUG_DRAIN_IDLE */
 }
 
 /**
@@ -215,3 +2904,145 @@ void debugReset(void)
         global_reset_func();
     #endif /* DEBUG_LEVEL >= DEBUG_MINIMAL */
 }
+
+/**
+ * @brief Internal function used to reset in place of a panic when messages
+ * are compiled out, see DEBUG_PANIC.
+ */
+void debug_panic_reset(void)
+{
+    if(global_reset_func != NULL) {
+        global_reset_func();
+    }
+    for(;;) {
+    }
+}
+
+/**
+ * @brief Set the run-time level of a log module. Messages of the module with
+ * a type above the level are discarded before they are formatted.
+ * @param module module ID, below DEBUG_MODULE_COUNT.
+ * @param level new level, DEBUG_OFF to DEBUG_FULL.
+ */
+void debugSetModuleLevel(uint8_t module, uint8_t level)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        if(module < DEBUG_MODULE_COUNT) {
+            __atomic_store_n(&debug_module_levels[module], level,
+                                                            __ATOMIC_RELAXED);
+        }
+    #else
+        /* Suppresses unused variable warnings */
+        (void)(module);
+        (void)(level);
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+}
+
+/**
+ * @brief Get the run-time level of a log module.
+ * @param module module ID, below DEBUG_MODULE_COUNT.
+ *
+ * @retval level of the module, DEBUG_OFF if the ID is not valid.
+ */
+uint8_t debugGetModuleLevel(uint8_t module)
+{
+    #if DEBUG_LEVEL >= DEBUG_ERRORS
+        if(module < DEBUG_MODULE_COUNT) {
+            return debug_module_levels[module];
+        }
+    #else
+        /* Suppresses unused variable warning */
+        (void)(module);
+    #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+    return DEBUG_OFF;
+}
+
+#if DEBUG_FAULT
+
+    /**
+     * @brief Report a fault through the panic output, then reset: the most
+     * recent records, the exception frame, the fault status registers and the
+     * current task. Uses neither the heap nor the message queue, which may be
+     * what failed.
+     * @param frame exception frame stacked by the fault (r0-r3, r12, lr, pc
+     * and xPSR).
+     */
+    void debugFault(const uint32_t* frame)
+    {
+        portDISABLE_INTERRUPTS();
+        #if DEBUG_LEVEL >= DEBUG_ERRORS
+            _Static_assert(DEBUG_MAX_ARGS >= 4,
+                                    "DEBUG_FAULT needs DEBUG_MAX_ARGS >= 4");
+            #if defined(__ARM_ARCH_6M__)
+                /* ARMv6-M has no configurable fault status registers */
+                uint32_t cfsr = 0, hfsr = 0, mmfar = 0, bfar = 0;
+            #else
+                uint32_t cfsr = SCB_CFSR, hfsr = SCB_HFSR;
+                uint32_t mmfar = SCB_MMFAR, bfar = SCB_BFAR;
+            #endif /* __ARM_ARCH_6M__ */
+
+            debug_panic_begin(true);
+            debug_panic_record(DEBUG_FAULT_FORMAT(
+                                "fault pc %08x lr %08x psr %08x"), 3,
+                                                frame[6], frame[5], frame[7]);
+            debug_panic_record(DEBUG_FAULT_FORMAT(
+                                "fault r0 %08x r1 %08x r2 %08x r3 %08x"), 4,
+                                        frame[0], frame[1], frame[2], frame[3]);
+            debug_panic_record(DEBUG_FAULT_FORMAT(
+                                "fault r12 %08x cfsr %08x hfsr %08x"), 3,
+                                                        frame[4], cfsr, hfsr);
+            debug_panic_record(DEBUG_FAULT_FORMAT(
+                                "fault mmfar %08x bfar %08x task %08x"), 3,
+                                mmfar, bfar,
+                        (uint32_t)DEBUG_WORD(xTaskGetCurrentTaskHandle()));
+        #else
+            /* Suppresses unused variable warning */
+            (void)(frame);
+        #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+        if(global_reset_func != NULL) {
+            global_reset_func();
+        }
+        for(;;) {
+        }
+    }
+
+    #if defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+
+        /**
+         * @brief Fault handler that passes the exception frame, on the main
+         * or the process stack, to debugFault.
+         */
+        __attribute__((naked)) void debugFaultHandler(void)
+        {
+            /* Thumb-1 only, so this also runs on ARMv6-M */
+            __asm volatile(
+                "movs r0, #4        \n"
+                "mov r1, lr         \n"
+                "tst r0, r1         \n"
+                "beq 1f             \n"
+                "mrs r0, psp        \n"
+                "ldr r1, =debugFault\n"
+                "bx r1              \n"
+                "1:                 \n"
+                "mrs r0, msp        \n"
+                "ldr r1, =debugFault\n"
+                "bx r1              \n"
+                ".ltorg             \n"
+            );
+        }
+
+        /** @brief libopencm3 fault vectors */
+        void hard_fault_handler(void)
+                                    __attribute__((alias("debugFaultHandler")));
+        #if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+            void mem_manage_handler(void)
+                                    __attribute__((alias("debugFaultHandler")));
+            void bus_fault_handler(void)
+                                    __attribute__((alias("debugFaultHandler")));
+            void usage_fault_handler(void)
+                                    __attribute__((alias("debugFaultHandler")));
+        #endif /* __ARM_ARCH_7M__ || __ARM_ARCH_7EM__ */
+
+    #endif /* __ARM_ARCH_PROFILE == 'M' */
+
+#endif /* DEBUG_FAULT */
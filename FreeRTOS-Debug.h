@@ -11,6 +11,8 @@
 #define __FREERTOS_DEBUG__
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 #include "FreeRTOS.h"
@@ -30,15 +32,767 @@
 #define DEBUG_TYPE_WARNING  'W'
 #define DEBUG_TYPE_ERROR    'E'
 
+/**
+ * @brief Whether a debug type is enabled by DEBUG_LEVEL. This is a constant
+ * expression for a constant type, so the compiler removes disabled messages.
+ */
+#define DEBUG_TYPE_ENABLED(debug_type) \
+    ((DEBUG_LEVEL >= DEBUG_ERRORS && (debug_type) == DEBUG_TYPE_ERROR) || \
+    (DEBUG_LEVEL >= DEBUG_WARNINGS && (debug_type) == DEBUG_TYPE_WARNING) || \
+    (DEBUG_LEVEL >= DEBUG_FULL && (debug_type) == DEBUG_TYPE_INFO))
+
+/**
+ * @brief Lowest debug level that enables a debug type, e.g. for sink levels.
+ */
+#define DEBUG_TYPE_LEVEL(debug_type) \
+    ((debug_type) == DEBUG_TYPE_ERROR ? DEBUG_ERRORS : \
+    (debug_type) == DEBUG_TYPE_WARNING ? DEBUG_WARNINGS : DEBUG_FULL)
+
+/**
+ * @brief Number of log modules, each with a level that can be changed at run
+ * time (see debugSetModuleLevel). Module IDs are compile-time constants below
+ * DEBUG_MODULE_COUNT, e.g. from an application enum. DEBUG_MESSAGE uses
+ * DEBUG_MODULE_DEFAULT.
+ */
+#ifndef DEBUG_MODULE_COUNT
+    #define DEBUG_MODULE_COUNT 8
+#endif /* DEBUG_MODULE_COUNT */
+
+/**
+ * @brief Level every module starts at. Types above DEBUG_LEVEL are compiled
+ * out, so to raise a module at run time build with a higher DEBUG_LEVEL and
+ * start the modules lower.
+ */
+#ifndef DEBUG_MODULE_LEVEL
+    #define DEBUG_MODULE_LEVEL DEBUG_LEVEL
+#endif /* DEBUG_MODULE_LEVEL */
+
+/** @brief Module of messages logged with DEBUG_MESSAGE */
+#define DEBUG_MODULE_DEFAULT 0
+
+/**
+ * @brief Rate limit every DEBUG_MESSAGE call site with a token bucket of its
+ * own, before the message is formatted. Calls over the limit are counted, and
+ * the count is logged just before the next message from the call site that is
+ * let through. Costs a few bytes of RAM per call site.
+ */
+#ifndef DEBUG_RATE_LIMIT
+    #define DEBUG_RATE_LIMIT 0
+#endif /* DEBUG_RATE_LIMIT */
+
+/** @brief Messages a call site can log in a burst, see DEBUG_RATE_LIMIT */
+#ifndef DEBUG_RATE_BURST
+    #define DEBUG_RATE_BURST 8
+#endif /* DEBUG_RATE_BURST */
+
+/**
+ * @brief Ticks it takes a call site to earn one more message, see
+ * DEBUG_RATE_LIMIT.
+ */
+#ifndef DEBUG_RATE_PERIOD
+    #define DEBUG_RATE_PERIOD pdMS_TO_TICKS(100)
+#endif /* DEBUG_RATE_PERIOD */
+
+/**
+ * @brief Debug Modes
+ * - DEBUG_MODE_TEXT: the calling task formats the message (default).
+ * - DEBUG_MODE_DEFERRED: the calling task only queues the format string and
+ * the raw argument words, and the debug task does the formatting.
+ * - DEBUG_MODE_BINARY: as DEBUG_MODE_DEFERRED, but the debug task sends the
+ * raw record and formatting is left to the host.
+ *
+ * In the deferred modes every argument is converted to a word (debug_word_t),
+ * so only integer, character and pointer arguments are supported. Strings
+ * passed with %s must outlive the message (e.g. string literals). The word is
+ * pointer-sized, so %s and %p also work on hosts with 64-bit pointers, but
+ * binary records only carry its low 32 bits.
+ */
+#define DEBUG_MODE_TEXT     0
+#define DEBUG_MODE_DEFERRED 1
+#define DEBUG_MODE_BINARY   2
+
+#ifndef DEBUG_MODE
+    #define DEBUG_MODE DEBUG_MODE_TEXT
+#endif /* DEBUG_MODE */
+
+/** @brief Argument word of the deferred modes, wide enough for a pointer */
+#if UINTPTR_MAX > UINT32_MAX
+    typedef uintptr_t debug_word_t;
+#else
+    typedef uint32_t debug_word_t;
+#endif /* UINTPTR_MAX > UINT32_MAX */
+
+/** @brief Maximum number of arguments per message in the deferred modes */
+#ifndef DEBUG_MAX_ARGS
+    #define DEBUG_MAX_ARGS 4
+#endif /* DEBUG_MAX_ARGS */
+
+/**
+ * @brief Set to 1 to enable DEBUG_MESSAGE_FROM_ISR. ISR messages are always
+ * recorded as a format string and argument words (see DEBUG_MODE_DEFERRED),
+ * so in DEBUG_MODE_TEXT this adds those fields to every message.
+ */
+#ifndef DEBUG_ISR
+    #define DEBUG_ISR 0
+#endif /* DEBUG_ISR */
+
+/** @brief Whether messages carry a format string and argument words */
+#define DEBUG_RECORD_ARGS (DEBUG_MODE != DEBUG_MODE_TEXT || DEBUG_ISR)
+
+/** @brief Replaces the end of messages that are too long to be stored */
+#ifndef DEBUG_TRUNCATION_MARKER
+    #define DEBUG_TRUNCATION_MARKER "..."
+#endif /* DEBUG_TRUNCATION_MARKER */
+
+/** @brief Size of the buffer the debug task formats deferred messages into */
+#ifndef DEBUG_RENDER_LENGTH
+    #define DEBUG_RENDER_LENGTH 128
+#endif /* DEBUG_RENDER_LENGTH */
+
+#if DEBUG_MAX_ARGS > 8
+    #error "DEBUG_MAX_ARGS cannot be greater than 8!!!"
+#endif /* DEBUG_MAX_ARGS > 8 */
+
+/** @brief Stack depth of the debug task, in words */
+#ifndef DEBUG_TASK_STACK_DEPTH
+    #define DEBUG_TASK_STACK_DEPTH 350
+#endif /* DEBUG_TASK_STACK_DEPTH */
+
+/** @brief Priority of the debug task */
+#ifndef DEBUG_TASK_PRIORITY
+    #define DEBUG_TASK_PRIORITY 1
+#endif /* DEBUG_TASK_PRIORITY */
+
+/**
+ * @brief Debug Clocks, used to timestamp every message as it is sent
+ * - DEBUG_CLOCK_TICKS: the FreeRTOS tick count (default).
+ * - DEBUG_CLOCK_DWT: the Cortex-M3/M4/M7 DWT cycle counter, which
+ * debugInitialise enables.
+ * - DEBUG_CLOCK_HOOK: uint32_t debugClockHook(void), provided by the
+ * application. It must be safe to call from interrupts.
+ */
+#define DEBUG_CLOCK_TICKS   0
+#define DEBUG_CLOCK_DWT     1
+#define DEBUG_CLOCK_HOOK    2
+
+#ifndef DEBUG_CLOCK
+    #define DEBUG_CLOCK DEBUG_CLOCK_TICKS
+#endif /* DEBUG_CLOCK */
+
+/**
+ * @brief Message Storage (DEBUG_MODE_TEXT only)
+ * - DEBUG_STORAGE_HEAP: each message string is allocated with pvPortMalloc
+ * (default).
+ * - DEBUG_STORAGE_POOL: each message string takes one fixed-size block from a
+ * statically allocated pool, and is truncated to DEBUG_POOL_BLOCK_SIZE.
+ *
+ * Either way, the message is only formatted once.
+ */
+#define DEBUG_STORAGE_HEAP  0
+#define DEBUG_STORAGE_POOL  1
+
+#ifndef DEBUG_STORAGE
+    #define DEBUG_STORAGE DEBUG_STORAGE_HEAP
+#endif /* DEBUG_STORAGE */
+
+/**
+ * @brief Maximum length of a message with DEBUG_STORAGE_HEAP, including the
+ * null terminator. The message is formatted on the stack of the calling task.
+ */
+#ifndef DEBUG_MESSAGE_LENGTH
+    #define DEBUG_MESSAGE_LENGTH 128
+#endif /* DEBUG_MESSAGE_LENGTH */
+
+/** @brief Size of each pool block, including the null terminator */
+#ifndef DEBUG_POOL_BLOCK_SIZE
+    #define DEBUG_POOL_BLOCK_SIZE 64
+#endif /* DEBUG_POOL_BLOCK_SIZE */
+
+/** @brief Number of pool blocks, i.e. messages that can be held at once */
+#ifndef DEBUG_POOL_BLOCK_COUNT
+    #define DEBUG_POOL_BLOCK_COUNT 16
+#endif /* DEBUG_POOL_BLOCK_COUNT */
+
+/**
+ * @brief Number of tasks that can log at once. Each task is given a free task
+ * ID the first time it logs, and its name is copied into a table then. IDs
+ * are only released by debugTaskDeleted, so without it short-lived tasks use
+ * them up. Tasks beyond the count are logged with DEBUG_TASK_ID_NONE, and
+ * with DEBUG_TRANSPORT_RING their messages are dropped.
+ */
+#ifndef DEBUG_TASK_COUNT
+    #define DEBUG_TASK_COUNT 8
+#endif /* DEBUG_TASK_COUNT */
+
+/**
+ * @brief Task ID Lookups, i.e. how the task ID of the logging task is found
+ * - DEBUG_TASK_LOOKUP_TABLE: the handle of each task that has an ID is kept
+ * in a table that is searched on every message (default). A task created
+ * after another was deleted may be given its handle, and unless
+ * debugTaskDeleted was called for the deleted task, the new task inherits
+ * its ID and is logged under its name.
+ * - DEBUG_TASK_LOOKUP_TLS: the ID is kept in thread local storage pointer
+ * DEBUG_TLS_INDEX, which the application must leave free.
+ * - DEBUG_TASK_LOOKUP_NUMBER: the ID is kept in the task number, see
+ * vTaskSetTaskNumber. Needs configUSE_TRACE_FACILITY, and the application
+ * must not set task numbers itself.
+ *
+ * With any lookup, IDs are released by calling debugTaskDeleted from the
+ * traceTASK_DELETE hook, declared in FreeRTOSConfig.h as
+ *     void debugTaskDeleted(struct tskTaskControlBlock* task);
+ *     #define traceTASK_DELETE(pxTCB) debugTaskDeleted(pxTCB)
+ */
+#define DEBUG_TASK_LOOKUP_TABLE     0
+#define DEBUG_TASK_LOOKUP_TLS       1
+#define DEBUG_TASK_LOOKUP_NUMBER    2
+
+#ifndef DEBUG_TASK_LOOKUP
+    #define DEBUG_TASK_LOOKUP DEBUG_TASK_LOOKUP_TABLE
+#endif /* DEBUG_TASK_LOOKUP */
+
+/** @brief Thread local storage pointer used with DEBUG_TASK_LOOKUP_TLS */
+#ifndef DEBUG_TLS_INDEX
+    #define DEBUG_TLS_INDEX 0
+#endif /* DEBUG_TLS_INDEX */
+
+/** @brief Task IDs that are not in the name table */
+#define DEBUG_TASK_ID_DEBUG 0xFD    /* the debug task itself */
+#define DEBUG_TASK_ID_ISR   0xFE    /* an interrupt, see debug_t.irq */
+#define DEBUG_TASK_ID_NONE  0xFF    /* a task beyond DEBUG_TASK_COUNT */
+
+#if DEBUG_TASK_COUNT > DEBUG_TASK_ID_DEBUG
+    #error "DEBUG_TASK_COUNT cannot be greater than 253!!!"
+#endif /* DEBUG_TASK_COUNT > DEBUG_TASK_ID_DEBUG */
+
+/**
+ * @brief Debug Transports
+ * - DEBUG_TRANSPORT_QUEUE: all tasks share one FreeRTOS queue (default).
+ * - DEBUG_TRANSPORT_RING: each task that logs has its own lock-free
+ * single-producer/single-consumer ring, which the debug task drains
+ * round-robin. There is one ring per task ID, see DEBUG_TASK_COUNT. Messages
+ * from tasks beyond DEBUG_TASK_COUNT, which have no ring, are dropped.
+ */
+#define DEBUG_TRANSPORT_QUEUE   0
+#define DEBUG_TRANSPORT_RING    1
+
+#ifndef DEBUG_TRANSPORT
+    #define DEBUG_TRANSPORT DEBUG_TRANSPORT_QUEUE
+#endif /* DEBUG_TRANSPORT */
+
+/** @brief Number of messages per ring, must be a power of two */
+#ifndef DEBUG_RING_LENGTH
+    #define DEBUG_RING_LENGTH 16
+#endif /* DEBUG_RING_LENGTH */
+
+/** @brief Maximum time the debug task sleeps before polling the rings */
+#ifndef DEBUG_RING_POLL_TICKS
+    #define DEBUG_RING_POLL_TICKS pdMS_TO_TICKS(100)
+#endif /* DEBUG_RING_POLL_TICKS */
+
+/**
+ * @brief Drain Modes, i.e. when waiting messages are output
+ * - DEBUG_DRAIN_TASK: the debug task wakes for every message (default).
+ * - DEBUG_DRAIN_BATCH: the debug task wakes once DEBUG_BATCH_THRESHOLD
+ * messages are waiting in the queue (or a ring), at once for an error, and at
+ * least every DEBUG_BATCH_TIMEOUT, then outputs everything that is waiting.
+ * - DEBUG_DRAIN_IDLE: there is no debug task. The application calls
+ * debugIdleHook from vApplicationIdleHook (configUSE_IDLE_HOOK), so messages
+ * are only output while no other task is ready to run.
+ */
+#define DEBUG_DRAIN_TASK    0
+#define DEBUG_DRAIN_BATCH   1
+#define DEBUG_DRAIN_IDLE    2
+
+#ifndef DEBUG_DRAIN
+    #define DEBUG_DRAIN DEBUG_DRAIN_TASK
+#endif /* DEBUG_DRAIN */
+
+/** @brief Number of waiting messages that wakes the debug task (BATCH) */
+#ifndef DEBUG_BATCH_THRESHOLD
+    #define DEBUG_BATCH_THRESHOLD 8
+#endif /* DEBUG_BATCH_THRESHOLD */
+
+/** @brief Maximum time messages wait to be output (BATCH) */
+#ifndef DEBUG_BATCH_TIMEOUT
+    #define DEBUG_BATCH_TIMEOUT pdMS_TO_TICKS(50)
+#endif /* DEBUG_BATCH_TIMEOUT */
+
+/**
+ * @brief Maximum number of messages output in one pass before the output is
+ * flushed. A bulk sink writes a pass out together as far as
+ * DEBUG_SINK_BUFFER_LENGTH allows.
+ */
+#ifndef DEBUG_DRAIN_LIMIT
+    #define DEBUG_DRAIN_LIMIT 16
+#endif /* DEBUG_DRAIN_LIMIT */
+
+/**
+ * @brief Overflow Policies, for messages sent while the queue (or the ring of
+ * the calling task) is full
+ * - DEBUG_OVERFLOW_DROP_NEWEST: the new message is dropped (default).
+ * - DEBUG_OVERFLOW_DROP_OLDEST: the oldest waiting message is dropped to make
+ * room for the new one.
+ * - DEBUG_OVERFLOW_BLOCK_ERRORS: errors wait up to DEBUG_OVERFLOW_TIMEOUT for
+ * space, other messages are dropped.
+ *
+ * Messages from interrupts never wait and never displace others, they are
+ * dropped. Every drop is counted (see debugGetDropCount), and the next message
+ * sent once there is space again is preceded by an "N messages dropped" error.
+ */
+#define DEBUG_OVERFLOW_DROP_NEWEST  0
+#define DEBUG_OVERFLOW_DROP_OLDEST  1
+#define DEBUG_OVERFLOW_BLOCK_ERRORS 2
+
+#ifndef DEBUG_OVERFLOW_POLICY
+    #define DEBUG_OVERFLOW_POLICY DEBUG_OVERFLOW_DROP_NEWEST
+#endif /* DEBUG_OVERFLOW_POLICY */
+
+/** @brief Maximum time an error waits for space with BLOCK_ERRORS */
+#ifndef DEBUG_OVERFLOW_TIMEOUT
+    #define DEBUG_OVERFLOW_TIMEOUT pdMS_TO_TICKS(10)
+#endif /* DEBUG_OVERFLOW_TIMEOUT */
+
+/** @brief Size of each of the two output buffers of every bulk sink */
+#ifndef DEBUG_SINK_BUFFER_LENGTH
+    #define DEBUG_SINK_BUFFER_LENGTH 128
+#endif /* DEBUG_SINK_BUFFER_LENGTH */
+
+/**
+ * @brief Maximum number of output sinks, including the one passed to
+ * debugInitialise. Every sink has its own output buffers, see
+ * DEBUG_SINK_BUFFER_LENGTH.
+ */
+#ifndef DEBUG_SINK_COUNT
+    #define DEBUG_SINK_COUNT 2
+#endif /* DEBUG_SINK_COUNT */
+
+/**
+ * @brief Size of the buffer each output record is rendered into once, before
+ * it is copied to the sinks. Longer text records are truncated.
+ */
+#ifndef DEBUG_RECORD_LENGTH
+    #define DEBUG_RECORD_LENGTH 192
+#endif /* DEBUG_RECORD_LENGTH */
+
+/** @brief Time the debug task waits before retrying a busy sink */
+#ifndef DEBUG_SINK_RETRY_TICKS
+    #define DEBUG_SINK_RETRY_TICKS pdMS_TO_TICKS(10)
+#endif /* DEBUG_SINK_RETRY_TICKS */
+
+/**
+ * @brief Build the stream compressor, see debugAddCompressedSink. Each
+ * compressed sink takes about DEBUG_COMPRESS_WINDOW + 512 bytes of RAM.
+ */
+#ifndef DEBUG_COMPRESS
+    #define DEBUG_COMPRESS 0
+#endif /* DEBUG_COMPRESS */
+
+/** @brief Number of sinks that can be compressed */
+#ifndef DEBUG_COMPRESS_SINKS
+    #define DEBUG_COMPRESS_SINKS 1
+#endif /* DEBUG_COMPRESS_SINKS */
+
+/**
+ * @brief Bytes of earlier output a compressed sink can refer back to. Longer
+ * windows find more repeats at the cost of RAM.
+ */
+#ifndef DEBUG_COMPRESS_WINDOW
+    #define DEBUG_COMPRESS_WINDOW 512
+#endif /* DEBUG_COMPRESS_WINDOW */
+
+#if DEBUG_COMPRESS && ((DEBUG_COMPRESS_WINDOW & \
+        (DEBUG_COMPRESS_WINDOW - 1)) != 0 || DEBUG_COMPRESS_WINDOW > 32768)
+    #error "DEBUG_COMPRESS_WINDOW must be a power of two up to 32768!!!"
+#endif /* DEBUG_COMPRESS_WINDOW */
+
+/**
+ * @brief Records a compressed sink writes between reset points, at which it
+ * forgets its earlier output, so that a host that starts reading mid-stream
+ * or loses bytes can pick the stream up again from the next one.
+ */
+#ifndef DEBUG_COMPRESS_RESET_INTERVAL
+    #define DEBUG_COMPRESS_RESET_INTERVAL 64
+#endif /* DEBUG_COMPRESS_RESET_INTERVAL */
+
+#if DEBUG_COMPRESS_RESET_INTERVAL < 1 || DEBUG_COMPRESS_RESET_INTERVAL > 65535
+    #error "DEBUG_COMPRESS_RESET_INTERVAL must be 1-65535!!!"
+#endif /* DEBUG_COMPRESS_RESET_INTERVAL */
+
+/**
+ * @brief Compressed stream format: a sequence of tokens.
+ * - 0x00-0x7F: a run of token + 1 literal bytes follows.
+ * - 0x80-0xFE: repeat token - 0x80 + 3 bytes of earlier output, starting
+ * distance bytes back. distance - 1 follows (2 bytes, little-endian).
+ * - 0xFF: reset point, DEBUG_COMPRESS_RESET. Repeats after it never reach
+ * back past it. The first record, and every DEBUG_COMPRESS_RESET_INTERVAL
+ * records after it, starts with one.
+ * Every record ends on a token boundary. Literal runs are split so that
+ * three 0xFF bytes in a row only occur at reset points, which a host that
+ * has lost its place can therefore find by scanning.
+ */
+#define DEBUG_COMPRESS_MATCH        0x80
+#define DEBUG_COMPRESS_MIN_MATCH    3
+#define DEBUG_COMPRESS_MAX_MATCH    (0x7E + DEBUG_COMPRESS_MIN_MATCH)
+#define DEBUG_COMPRESS_MAX_LITERALS 0x80
+#define DEBUG_COMPRESS_RESET        "\xFF\xFF\xFF"
+
+/**
+ * @brief Build the ITM sink, see debugAddItmSink. Needs a Cortex-M3/M4/M7
+ * with SWO, or the register shim below.
+ */
+#ifndef DEBUG_ITM
+    #define DEBUG_ITM 0
+#endif /* DEBUG_ITM */
+
+/**
+ * @brief First ITM stimulus port of the ITM sink. Info, warning and error
+ * records use this port and the two after it, so a probe can filter by type.
+ */
+#ifndef DEBUG_ITM_PORT
+    #define DEBUG_ITM_PORT 1
+#endif /* DEBUG_ITM_PORT */
+
+/**
+ * @brief ITM register shim. By default the ITM sink uses the libopencm3
+ * register definitions. For testing on a host, define all three to use fake
+ * registers instead:
+ * - DEBUG_ITM_ENABLED(port): non-zero if the ITM and the port are enabled.
+ * - DEBUG_ITM_READY(port): non-zero if the port can take another write.
+ * - DEBUG_ITM_WRITE(port, value, size): write a 1 or 4 byte value.
+ */
+#if DEBUG_ITM && !defined(DEBUG_ITM_WRITE)
+    #include <libopencm3/cm3/itm.h>
+    #define DEBUG_ITM_ENABLED(port) ((ITM_TCR & ITM_TCR_ITMENA) && \
+                                        (ITM_TER[(port) / 32] & \
+                                        (1u << ((port) % 32))))
+    #define DEBUG_ITM_READY(port) (ITM_STIM32(port) & ITM_STIM_FIFOREADY)
+    #define DEBUG_ITM_WRITE(port, value, size) do { \
+            if((size) == 4) { \
+                ITM_STIM32(port) = (value); \
+            } else { \
+                ITM_STIM8(port) = (uint8_t)(value); \
+            } \
+        } while(0)
+#endif /* DEBUG_ITM && !defined(DEBUG_ITM_WRITE) */
+
+/** @brief Length of the message queue in DEBUG_CONFIG_DEFAULT */
+#ifndef DEBUG_QUEUE_LENGTH
+    #define DEBUG_QUEUE_LENGTH 16
+#endif /* DEBUG_QUEUE_LENGTH */
+
+/**
+ * @brief Attribute for the buffers the library allocates statically (message
+ * pool, rings and task names), e.g. __attribute__((section(".ccmram"))) to
+ * keep them off the main SRAM bus.
+ */
+#ifndef DEBUG_BUFFER_ATTR
+    #define DEBUG_BUFFER_ATTR
+#endif /* DEBUG_BUFFER_ATTR */
+
+/**
+ * @brief Attribute for the output buffers used by write_func. These are
+ * usually read by DMA, so must not be placed anywhere DMA cannot reach
+ * (such as CCM RAM).
+ */
+#ifndef DEBUG_SINK_BUFFER_ATTR
+    #define DEBUG_SINK_BUFFER_ATTR
+#endif /* DEBUG_SINK_BUFFER_ATTR */
+
+/**
+ * @brief Keep the most recent output records in a RAM buffer that survives a
+ * reset, and output them again after the next debugInitialise, between boot
+ * markers (see DEBUG_BINARY_BOOT in binary mode).
+ */
+#ifndef DEBUG_CRASH_LOG
+    #define DEBUG_CRASH_LOG 0
+#endif /* DEBUG_CRASH_LOG */
+
+/** @brief Size of the crash log in bytes, see DEBUG_CRASH_LOG */
+#ifndef DEBUG_CRASH_LOG_LENGTH
+    #define DEBUG_CRASH_LOG_LENGTH 1024
+#endif /* DEBUG_CRASH_LOG_LENGTH */
+
+/**
+ * @brief Attribute for the crash log, which must place it in a section that
+ * is not cleared or initialised at startup.
+ */
+#ifndef DEBUG_CRASH_LOG_ATTR
+    #define DEBUG_CRASH_LOG_ATTR __attribute__((section(".noinit")))
+#endif /* DEBUG_CRASH_LOG_ATTR */
+
+/**
+ * @brief Build the fault handler, see debugFault. On Cortex-M this also
+ * defines the libopencm3 fault vectors (hard_fault_handler etc).
+ */
+#ifndef DEBUG_FAULT
+    #define DEBUG_FAULT 0
+#endif /* DEBUG_FAULT */
+
+/**
+ * @brief Give every deferred call site a debug_site_t descriptor in the
+ * debug_sites linker section, and refer to it by index in binary records
+ * instead of by format address. Needs a deferred mode, a GNU linker (for
+ * __start_debug_sites) and string literal format strings.
+ */
+#ifndef DEBUG_SITES
+    #define DEBUG_SITES 0
+#endif /* DEBUG_SITES */
+
+#if DEBUG_SITES && DEBUG_MODE == DEBUG_MODE_TEXT
+    #error "DEBUG_SITES needs DEBUG_MODE_DEFERRED or DEBUG_MODE_BINARY!!!"
+#endif /* DEBUG_SITES && DEBUG_MODE == DEBUG_MODE_TEXT */
+
+/**
+ * @brief Binary record layout (DEBUG_MODE_BINARY), all words little-endian:
+ * DEBUG_BINARY_SYNC, type, timestamp (4 bytes), task ID (1 byte),
+ * [IRQ number (2 bytes) if the task ID is DEBUG_TASK_ID_ISR],
+ * format address (4 bytes),
+ * argument count (1 byte), arguments (4 bytes each, the low 32 bits of
+ * each argument word).
+ *
+ * With DEBUG_SITES, records start with DEBUG_BINARY_SITE_SYNC instead and
+ * the format address is replaced by the call site index (2 bytes), so there
+ * can be at most DEBUG_SITES_MAX_RAW call sites, which debugInitialise
+ * checks with configASSERT. Frames (DEBUG_FRAMED) have no such limit.
+ *
+ * The name of each task is sent once, before its first record:
+ * DEBUG_BINARY_SYNC, DEBUG_BINARY_NAME, task ID (1 byte), task name + '\0'.
+ *
+ * The records of the previous boot that DEBUG_CRASH_LOG outputs come between
+ * two boot markers: DEBUG_BINARY_SYNC, DEBUG_BINARY_BOOT, DEBUG_BOOT_PREVIOUS
+ * before them or DEBUG_BOOT_CURRENT after them (1 byte). Task IDs and
+ * timestamps start again at each marker.
+ */
+#define DEBUG_BINARY_SYNC       0xA5
+#define DEBUG_BINARY_SITE_SYNC  0xA6
+#define DEBUG_BINARY_NAME       'N'
+#define DEBUG_BINARY_BOOT       'B'
+
+/** @brief Boot Markers, see DEBUG_BINARY_BOOT */
+#define DEBUG_BOOT_CURRENT      0
+#define DEBUG_BOOT_PREVIOUS     1
+
+/** @brief Most call sites an unframed DEBUG_SITES build can index */
+#define DEBUG_SITES_MAX_RAW     65536
+
+/**
+ * @brief Send binary records as compact frames rather than the fixed layout
+ * above, so that less bandwidth is used and the host can resynchronise after
+ * lost or corrupted bytes. Needs DEBUG_MODE_BINARY.
+ */
+#ifndef DEBUG_FRAMED
+    #define DEBUG_FRAMED 0
+#endif /* DEBUG_FRAMED */
+
+#if DEBUG_FRAMED && DEBUG_MODE != DEBUG_MODE_BINARY
+    #error "DEBUG_FRAMED needs DEBUG_MODE_BINARY!!!"
+#endif /* DEBUG_FRAMED && DEBUG_MODE != DEBUG_MODE_BINARY */
+
+/**
+ * @brief Records sent after a full timestamp before the next record of each
+ * type carries one again, which bounds how many records have a wrong time
+ * after a lost frame.
+ */
+#ifndef DEBUG_FRAME_SYNC_INTERVAL
+    #define DEBUG_FRAME_SYNC_INTERVAL 16
+#endif /* DEBUG_FRAME_SYNC_INTERVAL */
+
+#if DEBUG_FRAME_SYNC_INTERVAL < 1 || DEBUG_FRAME_SYNC_INTERVAL > 255
+    #error "DEBUG_FRAME_SYNC_INTERVAL must be 1-255!!!"
+#endif /* DEBUG_FRAME_SYNC_INTERVAL */
+
+/**
+ * @brief Frame layout (DEBUG_FRAMED): the payload and its CRC-16/CCITT
+ * (2 bytes, little-endian) are COBS encoded and followed by a 0x00 delimiter.
+ *
+ * Record payload: type | flags, timestamp, task ID (1 byte),
+ * [IRQ number if the task ID is DEBUG_TASK_ID_ISR], format address or call
+ * site index, arguments. Everything after the task ID is a varint (7 bits
+ * per byte, least significant first), and the IRQ number and arguments are
+ * zigzag encoded first so small negative values stay short. Only the low 32
+ * bits of each argument word are sent. The argument count follows from the
+ * frame length.
+ *
+ * The timestamp is a zigzag varint delta from the last record of the same or
+ * a more severe type, so that every sink can follow it whatever its level,
+ * or the full timestamp if DEBUG_FRAME_ABSOLUTE is set.
+ *
+ * Name payload: DEBUG_BINARY_NAME, task ID (1 byte), task name.
+ *
+ * Boot payload: DEBUG_BINARY_BOOT, boot marker (1 byte). Every chain starts
+ * again with a full timestamp after it.
+ */
+#define DEBUG_FRAME_ABSOLUTE    0x80
+#define DEBUG_FRAME_SITE        0x20
+
+/**
+ * @brief Static descriptor of a call site, see DEBUG_SITES. The host decoder
+ * reads these from the ELF file, so the layout must not change.
+ */
+typedef struct {
+    /** printf-style format string */
+    const char* format;
+    /** Source file of the call site */
+    const char* file;
+    /** Source line of the call site */
+    uint16_t line;
+    /** Log module, see DEBUG_MODULE_COUNT */
+    uint8_t module;
+    /** Debug type, or 0 if it is only known at run time */
+    char type;
+} debug_site_t;
+
+/**
+ * @brief Format of a deferred message: its call site descriptor with
+ * DEBUG_SITES, else its format string.
+ */
+#if DEBUG_SITES
+    typedef const debug_site_t* debug_format_t;
+    /*
+     * The explicit alignment stops the compiler padding out the section. A
+     * type that is not a compile-time constant is stored as 0.
+     */
+    #define DEBUG_SITE_FORMAT(debug_type, module, format) ({ \
+            static const debug_site_t debug_site \
+                    __attribute__((section("debug_sites"), used, \
+                                aligned(__alignof__(debug_site_t)))) = { \
+                (format), __FILE__, __LINE__, (module), \
+                __builtin_constant_p(debug_type) ? (debug_type) : 0 \
+            }; \
+            &debug_site; \
+        })
+    #define DEBUG_FORMAT_STRING(site) ((site)->format)
+#else
+    typedef const char* debug_format_t;
+    #define DEBUG_SITE_FORMAT(debug_type, module, format) (format)
+    #define DEBUG_FORMAT_STRING(format) (format)
+#endif /* DEBUG_SITES */
+
 /** @brief Debug struct that is added to the message queue */
 typedef struct {
     char type;
-    TaskHandle_t task_handle;
-    char* message;
+    uint32_t timestamp;
+    uint8_t task_id;
+    #if DEBUG_MODE == DEBUG_MODE_TEXT
+        char* message;
+    #endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+    #if DEBUG_RECORD_ARGS
+        debug_format_t format;
+        uint8_t arg_count;
+        debug_word_t args[DEBUG_MAX_ARGS];
+    #endif /* DEBUG_RECORD_ARGS */
+    #if DEBUG_ISR
+        /** IRQ number, only valid if task_id is DEBUG_TASK_ID_ISR */
+        int16_t irq;
+    #endif /* DEBUG_ISR */
 } debug_t;
 
+/**
+ * @brief Debug configuration, passed to debugInitialiseWithConfig. Start from
+ * DEBUG_CONFIG_DEFAULT and fill in the functions.
+ */
+typedef struct {
+    /** Length of the message queue, unused with DEBUG_TRANSPORT_RING */
+    size_t queue_length;
+    /** Initialises the output, called by the debug task when it starts */
+    void (*init_func)(void);
+    /** Sends one char in a non-blocking manner, unused if write_func is set */
+    void (*send_func)(char);
+    /** Starts a bulk write, see debugInitialiseBulk. May be NULL */
+    void (*write_func)(const char*, size_t);
+    /** Resets the system */
+    void (*reset_func)(void);
+    /**
+     * Sends one char, blocking until it is sent, with interrupts disabled.
+     * Used for panics and fault reports, the send_func of sink 0 is used
+     * instead if NULL. Required if sink 0 is a bulk sink (write_func only)
+     */
+    void (*panic_func)(char);
+    /** Stack depth of the debug task, in words */
+    uint32_t stack_depth;
+    /** Priority of the debug task */
+    UBaseType_t priority;
+    #if configSUPPORT_STATIC_ALLOCATION
+        /**
+         * Stack (stack_depth words) and control block of the debug task. If
+         * both are set the task is created statically, else on the heap.
+         */
+        StackType_t* task_stack;
+        StaticTask_t* task_buffer;
+        /**
+         * Storage (DEBUG_QUEUE_STORAGE_SIZE(queue_length) bytes) and control
+         * block of the message queue. If both are set the queue is created
+         * statically, else on the heap.
+         */
+        uint8_t* queue_storage;
+        StaticQueue_t* queue_buffer;
+    #endif /* configSUPPORT_STATIC_ALLOCATION */
+} debug_config_t;
+
+/** @brief Token bucket of one call site, see DEBUG_RATE_LIMIT */
+typedef struct {
+    /** Tick the bucket was last refilled at */
+    TickType_t refilled;
+    /** Messages logged since the bucket was full */
+    uint16_t spent;
+    /** Calls over the limit since the last message that was let through */
+    uint32_t suppressed;
+} debug_rate_t;
+
+/** @brief Default configuration, without any functions or static buffers */
+#define DEBUG_CONFIG_DEFAULT { \
+        .queue_length = DEBUG_QUEUE_LENGTH, \
+        .stack_depth = DEBUG_TASK_STACK_DEPTH, \
+        .priority = DEBUG_TASK_PRIORITY \
+    }
+
+/** @brief Bytes of queue storage needed for a queue of the given length */
+#define DEBUG_QUEUE_STORAGE_SIZE(queue_length) \
+        ((queue_length) * sizeof(debug_t))
+
+/** @brief Helper macros for splitting and packing DEBUG_MESSAGE arguments */
+#define DEBUG_CONCAT(a, b) DEBUG_CONCAT_(a, b)
+#define DEBUG_CONCAT_(a, b) a##b
+#define DEBUG_FORMAT(...) DEBUG_FORMAT_(__VA_ARGS__, _)
+#define DEBUG_FORMAT_(format, ...) (format)
+#define DEBUG_ARG_COUNT(...) \
+        DEBUG_ARG_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define DEBUG_ARG_COUNT_(format, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define DEBUG_WORD(arg) ((debug_word_t)(uintptr_t)(arg))
+#define DEBUG_PACK_ARGS(dest, ...) \
+        DEBUG_CONCAT(DEBUG_PACK_, DEBUG_ARG_COUNT(__VA_ARGS__))(dest, \
+                                                                __VA_ARGS__)
+#define DEBUG_PACK_0(d, f)
+#define DEBUG_PACK_1(d, f, a1) \
+        d[0] = DEBUG_WORD(a1)
+#define DEBUG_PACK_2(d, f, a1, a2) \
+        DEBUG_PACK_1(d, f, a1); d[1] = DEBUG_WORD(a2)
+#define DEBUG_PACK_3(d, f, a1, a2, a3) \
+        DEBUG_PACK_2(d, f, a1, a2); d[2] = DEBUG_WORD(a3)
+#define DEBUG_PACK_4(d, f, a1, a2, a3, a4) \
+        DEBUG_PACK_3(d, f, a1, a2, a3); d[3] = DEBUG_WORD(a4)
+#define DEBUG_PACK_5(d, f, a1, a2, a3, a4, a5) \
+        DEBUG_PACK_4(d, f, a1, a2, a3, a4); d[4] = DEBUG_WORD(a5)
+#define DEBUG_PACK_6(d, f, a1, a2, a3, a4, a5, a6) \
+        DEBUG_PACK_5(d, f, a1, a2, a3, a4, a5); d[5] = DEBUG_WORD(a6)
+#define DEBUG_PACK_7(d, f, a1, a2, a3, a4, a5, a6, a7) \
+        DEBUG_PACK_6(d, f, a1, a2, a3, a4, a5, a6); d[6] = DEBUG_WORD(a7)
+#define DEBUG_PACK_8(d, f, a1, a2, a3, a4, a5, a6, a7, a8) \
+        DEBUG_PACK_7(d, f, a1, a2, a3, a4, a5, a6, a7); d[7] = DEBUG_WORD(a8)
+
 /*----------------------------- Private Functions ----------------------------*/
 
+/** @brief Internal run-time level of each module, see debugSetModuleLevel */
+extern uint8_t debug_module_levels[DEBUG_MODULE_COUNT];
+
+/**
+ * @brief Whether a debug type is enabled for a module, by DEBUG_LEVEL and the
+ * module's run-time level. One load and compare for a constant type.
+ */
+#define DEBUG_MODULE_ENABLED(module, debug_type) \
+    (DEBUG_TYPE_ENABLED(debug_type) && \
+    debug_module_levels[module] >= DEBUG_TYPE_LEVEL(debug_type))
+
 /**
  * @brief Internal function used to allocate memory for the error string.
  * @param debug_type level of debugging (handled by preprocessor).
@@ -53,37 +807,213 @@ bool debug_check_level(char debug_type);
  */
 void debug_send_message(debug_t debug);
 
+/**
+ * @brief Internal function used add debug message to the queue from an ISR.
+ * @param debug debug struct that is passed to the queue.
+ */
+void debug_send_message_from_isr(debug_t debug);
+
+/**
+ * @brief Internal function used to allocate memory for the message string.
+ * @param length length of the message string, including the null terminator.
+ *
+ * @retval pointer to the string, or NULL if no memory is available.
+ */
+char* debug_alloc_message(size_t length);
+
+/**
+ * @brief Internal function used to free the memory of a message string.
+ * @param message string allocated with debug_alloc_message.
+ */
+void debug_free_message(char* message);
+
+/**
+ * @brief Internal function used to format a message once, straight into its
+ * storage, and add it to the queue.
+ * @param debug_type debug message type - see Debug Types.
+ * @param format printf-style format string, followed by its arguments.
+ */
+void debug_send_formatted(char debug_type, const char* format, ...)
+                                    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Internal function used to format a fatal message into a static
+ * buffer and output it synchronously.
+ * @param format printf-style format string, followed by its arguments.
+ */
+void debug_panic_formatted(const char* format, ...)
+                __attribute__((format(printf, 1, 2), noreturn));
+
+/**
+ * @brief Internal function used to output a fatal message synchronously.
+ * @param debug debug struct with the format and arguments.
+ */
+void debug_panic_message(debug_t debug) __attribute__((noreturn));
+
+/**
+ * @brief Internal function used to reset in place of a panic when messages
+ * are compiled out. Unlike debugReset it never returns, even at DEBUG_OFF.
+ */
+void debug_panic_reset(void) __attribute__((noreturn));
+
+/**
+ * @brief Internal function used to apply the rate limit of a call site.
+ * @param rate token bucket of the call site.
+ * @param debug_type debug message type - see Debug Types.
+ * @param from_isr true if called from an interrupt.
+ *
+ * @retval true if the message should be logged.
+ */
+bool debug_rate_limit(debug_rate_t* rate, char debug_type, bool from_isr);
+
+/** @brief Per-call-site rate limit state and check, see DEBUG_RATE_LIMIT */
+#if DEBUG_RATE_LIMIT
+    #define DEBUG_RATE_STATE static debug_rate_t debug_rate;
+    #define DEBUG_RATE_ALLOWED(debug_type, from_isr) \
+            debug_rate_limit(&debug_rate, debug_type, from_isr)
+#else
+    #define DEBUG_RATE_STATE
+    #define DEBUG_RATE_ALLOWED(debug_type, from_isr) true
+#endif /* DEBUG_RATE_LIMIT */
+
 /*------------------------------ Public Functions ----------------------------*/
 
+/**
+ * @brief Record the format string and argument words of a message and pass
+ * it to send_func, without formatting it.
+ * @param send_func debug_send_message or debug_send_message_from_isr.
+ * @param module log module of the call site.
+ * @param debug_type debug message type - see Debug Types.
+ * @param __VA_ARGS__ printf-style arguments.
+ */
+#define DEBUG_DEFERRED_MESSAGE(send_func, module, debug_type, ...) do { \
+        _Static_assert(DEBUG_ARG_COUNT(__VA_ARGS__) <= DEBUG_MAX_ARGS, \
+                        "Too many arguments for DEBUG_MAX_ARGS"); \
+        debug_t debug; \
+        if(DEBUG_TYPE_ENABLED(debug_type)) { \
+            debug.type = debug_type; \
+            debug.format = DEBUG_SITE_FORMAT(debug_type, module, \
+                                                DEBUG_FORMAT(__VA_ARGS__)); \
+            debug.arg_count = DEBUG_ARG_COUNT(__VA_ARGS__); \
+            DEBUG_PACK_ARGS(debug.args, __VA_ARGS__); \
+            send_func(debug); \
+        } \
+    } while(0)
+
 /**
  * @brief Add debug message to output queue.
  * @param debug_type debug message type - see Debug Types.
  * @param __VA_ARGS__ printf-style arguments.
+ *
+ * DEBUG_MESSAGE_FROM_ISR takes the same arguments and may be called from
+ * interrupts at or below configMAX_SYSCALL_INTERRUPT_PRIORITY (needs
+ * DEBUG_ISR). The message records the IRQ number instead of the task.
+ *
+ * DEBUG_MODULE_MESSAGE and DEBUG_MODULE_MESSAGE_FROM_ISR take a module ID
+ * first, and are filtered by the level of that module as well.
  */
 #ifdef DEBUG_LEVEL
 #if DEBUG_LEVEL >= DEBUG_ERRORS
-    #define DEBUG_MESSAGE(debug_type, ...) do { \
-            debug_t debug; \
-            if(debug_check_level(debug_type)) { \
-                debug.type = debug_type; \
-                debug.message = pvPortMalloc(snprintf(NULL, 0, __VA_ARGS__) + 1); \
-                sprintf(debug.message, __VA_ARGS__); \
-                debug_send_message(debug); \
+#if DEBUG_MODE == DEBUG_MODE_TEXT
+    #define DEBUG_MODULE_MESSAGE(module, debug_type, ...) do { \
+            _Static_assert((module) < DEBUG_MODULE_COUNT, \
+                                    "Module is not below DEBUG_MODULE_COUNT"); \
+            DEBUG_RATE_STATE \
+            if(DEBUG_MODULE_ENABLED(module, debug_type) && \
+                        DEBUG_RATE_ALLOWED(debug_type, false)) { \
+                debug_send_formatted(debug_type, __VA_ARGS__); \
             } \
         } while(0)
 #else
-    #define DEBUG_MESSAGE(debug_type, message)
+    #define DEBUG_MODULE_MESSAGE(module, debug_type, ...) do { \
+            _Static_assert((module) < DEBUG_MODULE_COUNT, \
+                                    "Module is not below DEBUG_MODULE_COUNT"); \
+            DEBUG_RATE_STATE \
+            if(DEBUG_MODULE_ENABLED(module, debug_type) && \
+                        DEBUG_RATE_ALLOWED(debug_type, false)) { \
+                DEBUG_DEFERRED_MESSAGE(debug_send_message, module, \
+                                                debug_type, __VA_ARGS__); \
+            } \
+        } while(0)
+#endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+#if DEBUG_ISR
+    #define DEBUG_MODULE_MESSAGE_FROM_ISR(module, debug_type, ...) do { \
+            _Static_assert((module) < DEBUG_MODULE_COUNT, \
+                                    "Module is not below DEBUG_MODULE_COUNT"); \
+            DEBUG_RATE_STATE \
+            if(DEBUG_MODULE_ENABLED(module, debug_type) && \
+                        DEBUG_RATE_ALLOWED(debug_type, true)) { \
+                DEBUG_DEFERRED_MESSAGE(debug_send_message_from_isr, module, \
+                                                debug_type, __VA_ARGS__); \
+            } \
+        } while(0)
+#endif /* DEBUG_ISR */
+#else
+    #define DEBUG_MODULE_MESSAGE(module, debug_type, ...) do { } while(0)
+    #define DEBUG_MODULE_MESSAGE_FROM_ISR(module, debug_type, ...) \
+            do { } while(0)
+#endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+#define DEBUG_MESSAGE(debug_type, ...) \
+        DEBUG_MODULE_MESSAGE(DEBUG_MODULE_DEFAULT, debug_type, __VA_ARGS__)
+#define DEBUG_MESSAGE_FROM_ISR(debug_type, ...) \
+        DEBUG_MODULE_MESSAGE_FROM_ISR(DEBUG_MODULE_DEFAULT, debug_type, \
+                                                                __VA_ARGS__)
+
+/**
+ * @brief Output a fatal error message, and every message still waiting in
+ * the queue, synchronously through the panic output (see debug_config_t) with
+ * interrupts masked, then reset. Use in place of DEBUG_MESSAGE followed by
+ * debugReset, which resets before the message is output. Tasks only.
+ * @param __VA_ARGS__ printf-style arguments.
+ */
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+#if DEBUG_MODE == DEBUG_MODE_TEXT
+    #define DEBUG_PANIC(...) debug_panic_formatted(__VA_ARGS__)
+#else
+    #define DEBUG_PANIC(...) \
+            DEBUG_DEFERRED_MESSAGE(debug_panic_message, DEBUG_MODULE_DEFAULT, \
+                                                DEBUG_TYPE_ERROR, __VA_ARGS__)
+#endif /* DEBUG_MODE == DEBUG_MODE_TEXT */
+#else
+    #define DEBUG_PANIC(...) debug_panic_reset()
 #endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
 #else
     /* The existence of DEBUG_LEVEL is only checked here. */
     #error "No Debug Level Defined!!!"
 #endif /* DEBUG_LEVEL */
 
+/**
+ * @brief Per-type shorthands for DEBUG_MESSAGE. A type that DEBUG_LEVEL
+ * disables expands to nothing, so neither its format string nor its arguments
+ * are compiled in.
+ * @param __VA_ARGS__ printf-style arguments.
+ */
+#if DEBUG_LEVEL >= DEBUG_FULL
+    #define DEBUG_INFO(...) DEBUG_MESSAGE(DEBUG_TYPE_INFO, __VA_ARGS__)
+#else
+    #define DEBUG_INFO(...) do { } while(0)
+#endif /* DEBUG_LEVEL >= DEBUG_FULL */
+
+#if DEBUG_LEVEL >= DEBUG_WARNINGS
+    #define DEBUG_WARNING(...) DEBUG_MESSAGE(DEBUG_TYPE_WARNING, __VA_ARGS__)
+#else
+    #define DEBUG_WARNING(...) do { } while(0)
+#endif /* DEBUG_LEVEL >= DEBUG_WARNINGS */
+
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+    #define DEBUG_ERROR(...) DEBUG_MESSAGE(DEBUG_TYPE_ERROR, __VA_ARGS__)
+#else
+    #define DEBUG_ERROR(...) do { } while(0)
+#endif /* DEBUG_LEVEL >= DEBUG_ERRORS */
+
 /**
  * @brief Initialise the queues and tasks associated with the debug handler.
+ * They are allocated from the FreeRTOS heap, so this needs
+ * configSUPPORT_DYNAMIC_ALLOCATION, see debugInitialiseWithConfig.
  * @param queue_length defines the length of the message queue. While the a long
  * message queue does not use up much memory, the dynamically allocated message
- * strings that the queue items point to do. Keep as low as possible.
+ * strings that the queue items point to do. Keep as low as possible. Unused
+ * with DEBUG_TRANSPORT_RING, see DEBUG_RING_LENGTH.
  * @param init_func function pointer to a function that initialises the output
  * means that send_func uses to do the logging.
  * @param send_func function pointer to a function that sends one char in a
@@ -95,6 +1025,141 @@ void debug_send_message(debug_t debug);
 TaskHandle_t* debugInitialise(size_t queue_length, void (*init_func)(void),
                             void (*send_func)(char), void (*reset_func)(void));
 
+/**
+ * @brief Initialise the debug handler with a bulk write function in place of
+ * a per-character send function. Panics and fault reports need a panic_func,
+ * which only debugInitialiseWithConfig can set.
+ * @param queue_length see debugInitialise.
+ * @param init_func see debugInitialise.
+ * @param write_func function pointer to a function that starts writing a
+ * buffer of the given length, e.g. by DMA. The buffer stays valid until
+ * debugWriteComplete or debugWriteCompleteFromISR is called.
+ * @param reset_func see debugInitialise.
+ *
+ * @retval pointer to handle of the task that was created to handle debugging.
+ */
+TaskHandle_t* debugInitialiseBulk(size_t queue_length, void (*init_func)(void),
+                            void (*write_func)(const char*, size_t),
+                            void (*reset_func)(void));
+
+/**
+ * @brief Initialise the debug handler from a configuration. With static
+ * buffers for the task and queue, DEBUG_STORAGE_POOL (or a deferred mode) and
+ * configSUPPORT_STATIC_ALLOCATION, nothing is allocated from the heap. With
+ * configSUPPORT_DYNAMIC_ALLOCATION 0 those buffers are required.
+ * @param config configuration, only read during the call.
+ *
+ * @retval pointer to handle of the task that was created to handle debugging.
+ */
+TaskHandle_t* debugInitialiseWithConfig(const debug_config_t* config);
+
+/**
+ * @brief Add another output sink. Every record is rendered once and copied to
+ * each sink whose level enables its type.
+ * @param send_func function pointer to a function that sends one char in a
+ * non-blocking manner, or NULL if write_func is given.
+ * @param write_func function pointer to a function that starts writing a
+ * buffer, see debugInitialiseBulk, or NULL if send_func is given. Completion
+ * is signalled with debugSinkWriteComplete.
+ * @param level debug level of the sink, e.g. DEBUG_ERRORS for errors only.
+ *
+ * @retval index of the sink, or -1 if DEBUG_SINK_COUNT sinks already exist.
+ */
+int8_t debugAddSink(void (*send_func)(char),
+                        void (*write_func)(const char*, size_t), uint8_t level);
+
+/**
+ * @brief Signal that the buffer passed to the write_func of a sink has been
+ * written out.
+ * @param sink index of the sink, as returned by debugAddSink.
+ */
+void debugSinkWriteComplete(uint8_t sink);
+
+/**
+ * @brief Signal from an interrupt that the buffer passed to the write_func of
+ * a sink has been written out.
+ * @param sink index of the sink, as returned by debugAddSink.
+ * @param higher_priority_task_woken set to pdTRUE if a context switch should
+ * be requested before the interrupt exits.
+ */
+void debugSinkWriteCompleteFromISR(uint8_t sink,
+                                    BaseType_t* higher_priority_task_woken);
+
+/**
+ * @brief Add a sink that writes records to the ITM stimulus ports, one per
+ * debug type starting at DEBUG_ITM_PORT. Needs DEBUG_ITM.
+ * @param level highest debug level written to the sink.
+ *
+ * @retval index of the sink, or -1 if DEBUG_SINK_COUNT sinks already exist.
+ */
+int8_t debugAddItmSink(uint8_t level);
+
+/**
+ * @brief Add an output sink whose output is compressed, e.g. for a flash
+ * logger or a slow radio link. Needs DEBUG_COMPRESS. See debugAddSink for
+ * the parameters.
+ *
+ * @retval index of the sink, or -1 if DEBUG_SINK_COUNT sinks or
+ * DEBUG_COMPRESS_SINKS compressed sinks already exist.
+ */
+int8_t debugAddCompressedSink(void (*send_func)(char),
+                        void (*write_func)(const char*, size_t), uint8_t level);
+
+/**
+ * @brief Signal that the buffer passed to write_func has been written out.
+ */
+void debugWriteComplete(void);
+
+/**
+ * @brief Signal from an interrupt that the buffer passed to write_func has
+ * been written out.
+ * @param higher_priority_task_woken set to pdTRUE if a context switch should
+ * be requested before the interrupt exits.
+ */
+void debugWriteCompleteFromISR(BaseType_t* higher_priority_task_woken);
+
+/**
+ * @brief Number of messages that were discarded because the message pool
+ * (DEBUG_STORAGE_POOL) was empty.
+ *
+ * @retval number of failed allocations since initialisation.
+ */
+uint32_t debugGetPoolFailures(void);
+
+/**
+ * @brief Number of messages of a type that were dropped, whether because the
+ * queue was full or because no memory was available for them.
+ * @param debug_type debug message type - see Debug Types.
+ *
+ * @retval number of dropped messages since initialisation.
+ */
+uint32_t debugGetDropCount(char debug_type);
+
+#if DEBUG_CLOCK == DEBUG_CLOCK_HOOK
+    /**
+     * @brief Timestamp source for DEBUG_CLOCK_HOOK, provided by the
+     * application.
+     *
+     * @retval current time, in any unit.
+     */
+    uint32_t debugClockHook(void);
+#endif /* DEBUG_CLOCK == DEBUG_CLOCK_HOOK */
+
+/**
+ * @brief Release the task ID of a task that is being deleted, so that it can
+ * be given to a new task. Call it from traceTASK_DELETE, see
+ * DEBUG_TASK_LOOKUP.
+ * @param task task being deleted, or NULL for the calling task.
+ */
+void debugTaskDeleted(TaskHandle_t task);
+
+/**
+ * @brief Output every waiting message. With DEBUG_DRAIN_IDLE this must be
+ * called from vApplicationIdleHook, and nowhere else. It does nothing in the
+ * other drain modes.
+ */
+void debugIdleHook(void);
+
 /**
  * @brief Suspend all tasks and halt everything for debugging.
  */
@@ -110,4 +1175,35 @@ void debugFreezeTask(void);
  */
 void debugReset(void);
 
+/**
+ * @brief Set the run-time level of a log module.
+ * @param module module ID, below DEBUG_MODULE_COUNT.
+ * @param level new level, DEBUG_OFF to DEBUG_FULL.
+ */
+void debugSetModuleLevel(uint8_t module, uint8_t level);
+
+/**
+ * @brief Get the run-time level of a log module.
+ * @param module module ID, below DEBUG_MODULE_COUNT.
+ *
+ * @retval level of the module, DEBUG_OFF if the ID is not valid.
+ */
+uint8_t debugGetModuleLevel(uint8_t module);
+
+#if DEBUG_FAULT
+    /**
+     * @brief Report a fault through the panic output, then reset. Does not use
+     * the heap or the message queue.
+     * @param frame exception frame stacked by the fault (r0-r3, r12, lr, pc
+     * and xPSR).
+     */
+    void debugFault(const uint32_t* frame);
+
+    /**
+     * @brief Fault handler that finds the exception frame and calls
+     * debugFault. Cortex-M only.
+     */
+    void debugFaultHandler(void);
+#endif /* DEBUG_FAULT */
+
 #endif /* __FREERTOS_DEBUG__ */
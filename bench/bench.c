@@ -0,0 +1,384 @@
+/**
+ * @file
+ * @brief benchmark of FreeRTOS-Debug on the FreeRTOS POSIX simulator
+ *
+ * Starts a number of producer tasks that each log a fixed number of messages
+ * as fast as they can, then reports the cost of each DEBUG_MESSAGE call, the
+ * rate at which records reach the sink and how many of them were lost.
+ *
+ * Usage: bench [-t tasks] [-n messages] [-d delay] [-b] [-o capture]
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include "FreeRTOS-Debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Most producer tasks the benchmark can start */
+#define BENCH_MAX_TASKS     64
+
+/** @brief Priority of the producer tasks, above the debug task by default */
+#define BENCH_PRIORITY      (DEBUG_TASK_PRIORITY + 1)
+
+/** @brief Timing of one producer task */
+typedef struct {
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} bench_timing_t;
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Command line settings */
+static unsigned bench_tasks = 4;
+static unsigned bench_messages = 10000;
+static TickType_t bench_delay = 0;
+static bool bench_bulk = false;
+static FILE* bench_capture;
+
+/** @brief Per-task call timing, each only written by its own task */
+static bench_timing_t bench_timing[BENCH_MAX_TASKS];
+
+/** @brief Number of producer tasks that have finished */
+static volatile unsigned bench_finished;
+
+/** @brief Sink statistics, only written by the debug task */
+static volatile uint64_t bench_bytes;
+static volatile uint64_t bench_records;
+static volatile uint64_t bench_last_ns;
+
+/** @brief Time the producers were started */
+static uint64_t bench_start_ns;
+
+/*---------------------------------- Clock -----------------------------------*/
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @retval time in nanoseconds.
+ */
+static uint64_t bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/**
+ * @brief Timestamp source for DEBUG_CLOCK_HOOK builds.
+ *
+ * @retval time in microseconds.
+ */
+uint32_t debugClockHook(void)
+{
+    return (uint32_t)(bench_now() / 1000);
+}
+
+/*----------------------------------- Sink -----------------------------------*/
+
+/**
+ * @brief Count the records in the output stream.
+ * @param c next byte of the stream.
+ */
+static void bench_count(uint8_t c)
+{
+    #if DEBUG_FRAMED
+        /* Every frame ends in a zero, and name frames are not counted */
+        static size_t position;
+        static bool name;
+        if(c == 0) {
+            bench_records += !name;
+            position = 0;
+            name = false;
+        } else if(position++ == 1) {
+            /* The first byte is the COBS code, then the payload starts */
+            name = (c == DEBUG_BINARY_NAME);
+        }
+    #elif DEBUG_MODE == DEBUG_MODE_BINARY
+        static enum {
+            SYNC, TYPE, TASK_NAME, TIMESTAMP, TASK_ID, IRQ, FORMAT, COUNT, ARGS
+        } state = SYNC;
+        static size_t remaining;
+        /* Size of the format field, the call site index with DEBUG_SITES */
+        static size_t format_size;
+        switch(state) {
+            case SYNC:
+                if(c == DEBUG_BINARY_SYNC || c == DEBUG_BINARY_SITE_SYNC) {
+                    state = TYPE;
+                    format_size = (c == DEBUG_BINARY_SITE_SYNC) ? 2 : 4;
+                }
+                break;
+            case TYPE:
+                /* Name records (task ID and name) are not counted */
+                if(format_size == 4 && c == DEBUG_BINARY_NAME) {
+                    state = TASK_NAME;
+                    remaining = 1;
+                } else {
+                    state = TIMESTAMP;
+                    remaining = 4;
+                }
+                break;
+            case TASK_NAME:
+                if(remaining > 0) {
+                    remaining--;
+                } else if(c == '\0') {
+                    state = SYNC;
+                }
+                break;
+            case TIMESTAMP:
+                if(--remaining == 0) {
+                    state = TASK_ID;
+                }
+                break;
+            case TASK_ID:
+                state = (c == DEBUG_TASK_ID_ISR) ? IRQ : FORMAT;
+                remaining = (c == DEBUG_TASK_ID_ISR) ? 2 : format_size;
+                break;
+            case IRQ:
+                if(--remaining == 0) {
+                    state = FORMAT;
+                    remaining = format_size;
+                }
+                break;
+            case FORMAT:
+                if(--remaining == 0) {
+                    state = COUNT;
+                }
+                break;
+            case COUNT:
+                remaining = 4 * c;
+                state = (remaining == 0) ? SYNC : ARGS;
+                bench_records += (remaining == 0);
+                break;
+            case ARGS:
+                if(--remaining == 0) {
+                    state = SYNC;
+                    bench_records++;
+                }
+                break;
+        }
+    #else
+        bench_records += (c == '\n');
+    #endif /* DEBUG_FRAMED */
+}
+
+/**
+ * @brief Bulk sink, which completes every write immediately.
+ * @param data bytes to write.
+ * @param length number of bytes.
+ */
+static void bench_write(const char* data, size_t length)
+{
+    for(size_t i = 0; i < length; i++) {
+        bench_count((uint8_t)data[i]);
+    }
+    if(bench_capture != NULL) {
+        fwrite(data, 1, length, bench_capture);
+    }
+    bench_bytes += length;
+    bench_last_ns = bench_now();
+    debugWriteComplete();
+}
+
+/**
+ * @brief Per-character sink.
+ * @param c character to write.
+ */
+static void bench_send(char c)
+{
+    bench_count((uint8_t)c);
+    if(bench_capture != NULL) {
+        fputc(c, bench_capture);
+    }
+    bench_bytes++;
+    bench_last_ns = bench_now();
+}
+
+/**
+ * @brief Sink initialisation, nothing to do on the host.
+ */
+static void bench_init(void)
+{
+}
+
+/**
+ * @brief Reset function, ends the benchmark.
+ */
+static void bench_reset(void)
+{
+    exit(EXIT_FAILURE);
+}
+
+/*---------------------------------- Tasks -----------------------------------*/
+
+/**
+ * @brief Producer task, logs bench_messages messages and times every call.
+ * @param args index of the task.
+ */
+static void bench_producer(void* args)
+{
+    unsigned index = (unsigned)(uintptr_t)args;
+    bench_timing_t* timing = &bench_timing[index];
+    timing->min_ns = UINT64_MAX;
+
+    for(unsigned i = 0; i < bench_messages; i++) {
+        uint64_t start = bench_now();
+        DEBUG_MESSAGE(DEBUG_TYPE_INFO, "task %u message %u", index, i);
+        uint64_t elapsed = bench_now() - start;
+
+        timing->total_ns += elapsed;
+        if(elapsed < timing->min_ns) {
+            timing->min_ns = elapsed;
+        }
+        if(elapsed > timing->max_ns) {
+            timing->max_ns = elapsed;
+        }
+        if(bench_delay != 0) {
+            vTaskDelay(bench_delay);
+        }
+    }
+
+    __atomic_add_fetch(&bench_finished, 1, __ATOMIC_RELEASE);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Reporter task, waits for the producers and the sink to finish and
+ * prints the results.
+ * @param args unused.
+ */
+static void bench_reporter(void* args __attribute((unused)))
+{
+    while(__atomic_load_n(&bench_finished, __ATOMIC_ACQUIRE) < bench_tasks) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    /* The sink is finished once everything arrived or it has gone idle */
+    uint64_t total = (uint64_t)bench_tasks * bench_messages;
+    uint64_t records;
+    do {
+        records = bench_records;
+        vTaskDelay(pdMS_TO_TICKS(200));
+    } while(bench_records < total && records != bench_records);
+
+    bench_timing_t all = { 0, UINT64_MAX, 0 };
+    for(unsigned i = 0; i < bench_tasks; i++) {
+        all.total_ns += bench_timing[i].total_ns;
+        if(bench_timing[i].min_ns < all.min_ns) {
+            all.min_ns = bench_timing[i].min_ns;
+        }
+        if(bench_timing[i].max_ns > all.max_ns) {
+            all.max_ns = bench_timing[i].max_ns;
+        }
+    }
+    double seconds = (bench_last_ns - bench_start_ns) / 1e9;
+    /* Drop reports reach the sink as records of their own */
+    uint64_t lost = debugGetDropCount(DEBUG_TYPE_INFO);
+
+    printf("tasks %u, messages %u per task, %s sink\n", bench_tasks,
+                            bench_messages, bench_bulk ? "bulk" : "per-char");
+    printf("DEBUG_MESSAGE: min %llu ns, mean %llu ns, max %llu ns\n",
+                            (unsigned long long)all.min_ns,
+                            (unsigned long long)(all.total_ns / total),
+                            (unsigned long long)all.max_ns);
+    printf("sink: %llu records, %llu bytes in %.3f s (%.0f records/s)\n",
+                            (unsigned long long)bench_records,
+                            (unsigned long long)bench_bytes, seconds,
+                            bench_records / seconds);
+    printf("lost: %llu records (%.2f %%), pool failures %lu\n",
+                            (unsigned long long)lost, 100.0 * lost / total,
+                            (unsigned long)debugGetPoolFailures());
+
+    if(bench_capture != NULL) {
+        fclose(bench_capture);
+    }
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
+/*------------------------------------ Main ----------------------------------*/
+
+/**
+ * @brief Idle hook, which drains the debug output with DEBUG_DRAIN_IDLE.
+ */
+void vApplicationIdleHook(void)
+{
+    debugIdleHook();
+}
+
+/**
+ * @brief Called by configASSERT.
+ * @param file file of the failed assertion.
+ * @param line line of the failed assertion.
+ */
+void vAssertCalled(const char* file, unsigned long line)
+{
+    fprintf(stderr, "assertion failed at %s:%lu\n", file, line);
+    abort();
+}
+
+int main(int argc, char** argv)
+{
+    int option;
+    while((option = getopt(argc, argv, "t:n:d:bo:")) != -1) {
+        switch(option) {
+            case 't':
+                bench_tasks = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                bench_messages = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                bench_delay = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                bench_bulk = true;
+                break;
+            case 'o':
+                bench_capture = fopen(optarg, "wb");
+                if(bench_capture == NULL) {
+                    perror(optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t tasks] [-n messages] "
+                            "[-d delay] [-b] [-o capture]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(bench_tasks == 0 || bench_tasks > BENCH_MAX_TASKS ||
+                                                    bench_messages == 0) {
+        fprintf(stderr, "tasks must be 1-%d and messages at least 1\n",
+                                                            BENCH_MAX_TASKS);
+        return EXIT_FAILURE;
+    }
+
+    if(bench_bulk) {
+        debugInitialiseBulk(64, bench_init, bench_write, bench_reset);
+    } else {
+        debugInitialise(64, bench_init, bench_send, bench_reset);
+    }
+
+    for(unsigned i = 0; i < bench_tasks; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "producer%u", i % BENCH_MAX_TASKS);
+        xTaskCreate(bench_producer, name, configMINIMAL_STACK_SIZE,
+                                (void*)(uintptr_t)i, BENCH_PRIORITY, NULL);
+    }
+    xTaskCreate(bench_reporter, "reporter", configMINIMAL_STACK_SIZE, NULL,
+                                                    BENCH_PRIORITY + 1, NULL);
+
+    bench_start_ns = bench_now();
+    vTaskStartScheduler();
+    return EXIT_FAILURE;
+}
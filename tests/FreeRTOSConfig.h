@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief FreeRTOS configuration for the POSIX simulator test builds
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <limits.h>
+
+/*--------------------------------- Scheduler --------------------------------*/
+
+#define configUSE_PREEMPTION                    1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
+#define configUSE_TIME_SLICING                  1
+#define configTICK_RATE_HZ                      1000
+#define configMAX_PRIORITIES                    5
+#define configMINIMAL_STACK_SIZE    ((unsigned short)PTHREAD_STACK_MIN)
+#define configMAX_TASK_NAME_LEN                 16
+#define configUSE_16_BIT_TICKS                  0
+#define configIDLE_SHOULD_YIELD                 1
+
+/*---------------------------------- Memory ----------------------------------*/
+
+#define configSUPPORT_DYNAMIC_ALLOCATION        1
+#define configSUPPORT_STATIC_ALLOCATION         0
+#define configTOTAL_HEAP_SIZE                   ((size_t)(16 * 1024 * 1024))
+
+/*--------------------------------- Features ---------------------------------*/
+
+#define configUSE_IDLE_HOOK                     1
+#define configUSE_TICK_HOOK                     0
+#define configUSE_MALLOC_FAILED_HOOK            0
+#define configCHECK_FOR_STACK_OVERFLOW          0
+#define configUSE_TRACE_FACILITY                1
+#define configUSE_MUTEXES                       1
+#define configUSE_COUNTING_SEMAPHORES           1
+#define configUSE_TASK_NOTIFICATIONS            1
+#define configUSE_TIMERS                        0
+#define configUSE_CO_ROUTINES                   0
+#define configQUEUE_REGISTRY_SIZE               0
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 2
+
+#define INCLUDE_vTaskDelete                     1
+#define INCLUDE_vTaskSuspend                    1
+#define INCLUDE_vTaskDelay                      1
+#define INCLUDE_xTaskGetCurrentTaskHandle       1
+#define INCLUDE_xTaskGetSchedulerState          1
+#define INCLUDE_xTaskGetHandle                  1
+
+/*--------------------------------- Debugging --------------------------------*/
+
+void vAssertCalled(const char* file, unsigned long line);
+#define configASSERT(x) if(!(x)) { vAssertCalled(__FILE__, __LINE__); }
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,45 @@
+/**
+ * @file
+ * @brief fake ITM registers for test_itm, see the ITM register shim in
+ * FreeRTOS-Debug.h. Included ahead of every source file of the test.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#ifndef ITM_FAKE_H
+#define ITM_FAKE_H
+
+#include <stdint.h>
+
+#define DEBUG_ITM_ENABLED(port) itm_fake_enabled(port)
+#define DEBUG_ITM_READY(port) itm_fake_ready(port)
+#define DEBUG_ITM_WRITE(port, value, size) \
+    itm_fake_write((port), (value), (size))
+
+/**
+ * @brief Whether a stimulus port is enabled.
+ * @param port stimulus port.
+ *
+ * @retval non-zero if enabled.
+ */
+int itm_fake_enabled(unsigned port);
+
+/**
+ * @brief Whether a stimulus port can take another write.
+ * @param port stimulus port.
+ *
+ * @retval non-zero if ready.
+ */
+int itm_fake_ready(unsigned port);
+
+/**
+ * @brief Write to a stimulus port.
+ * @param port stimulus port.
+ * @param value value to write, of which size bytes are used.
+ * @param size 1 or 4.
+ */
+void itm_fake_write(unsigned port, uint32_t value, unsigned size);
+
+#endif /* ITM_FAKE_H */
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief minimal test harness for the FreeRTOS-Debug host tests
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Number of checks made and failed */
+static unsigned test_checks;
+static unsigned test_failures;
+
+/** @brief Test body run by test_task */
+static void (*test_body)(void);
+
+/*-------------------------------- Functions ---------------------------------*/
+
+void test_check(bool passed, const char* condition, const char* file,
+                                                                    int line)
+{
+    test_checks++;
+    if(!passed) {
+        test_failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+    }
+}
+
+/**
+ * @brief Runs the test body and exits with its result.
+ * @param args unused.
+ */
+static void test_task(void* args __attribute((unused)))
+{
+    test_body();
+    printf("%u checks, %u failed\n", test_checks, test_failures);
+    fflush(stdout);
+    exit(test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void test_run(void (*body)(void))
+{
+    test_body = body;
+    /* Below the debug task, so that it drains whenever the test blocks */
+    xTaskCreate(test_task, "test", configMINIMAL_STACK_SIZE, NULL,
+                                                tskIDLE_PRIORITY, NULL);
+    vTaskStartScheduler();
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Idle hook, which drains the debug output with DEBUG_DRAIN_IDLE.
+ */
+void vApplicationIdleHook(void)
+{
+    debugIdleHook();
+}
+
+/**
+ * @brief Called by configASSERT.
+ * @param file file of the failed assertion.
+ * @param line line of the failed assertion.
+ */
+void vAssertCalled(const char* file, unsigned long line)
+{
+    fprintf(stderr, "assertion failed at %s:%lu\n", file, line);
+    abort();
+}
@@ -0,0 +1,58 @@
+/**
+ * @file
+ * @brief minimal test harness for the FreeRTOS-Debug host tests
+ *
+ * Each test is its own program, built against the FreeRTOS POSIX port with
+ * the library configuration it needs. test_run starts the scheduler and runs
+ * the test body in a task, then exits with the number of failed checks.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "FreeRTOS-Debug.h"
+
+#include <stdbool.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Ticks TEST_WAIT waits for its condition before failing */
+#define TEST_TIMEOUT pdMS_TO_TICKS(1000)
+
+/** @brief Count a failed check, and print it with its location */
+#define TEST_CHECK(condition) \
+    test_check((condition), #condition, __FILE__, __LINE__)
+
+/** @brief Wait for a condition, e.g. for the debug task to emit a record */
+#define TEST_WAIT(condition) do { \
+        TickType_t test_waited = 0; \
+        while(!(condition) && test_waited++ < TEST_TIMEOUT) { \
+            vTaskDelay(1); \
+        } \
+        TEST_CHECK(condition); \
+    } while(0)
+
+/*-------------------------------- Functions ---------------------------------*/
+
+/**
+ * @brief Count a check, see TEST_CHECK.
+ * @param passed result of the check.
+ * @param condition text of the check.
+ * @param file file of the check.
+ * @param line line of the check.
+ */
+void test_check(bool passed, const char* condition, const char* file,
+                                                                    int line);
+
+/**
+ * @brief Run a test body in a task below the debug task's priority and exit
+ * once it returns. Does not return.
+ * @param body test body, which may block.
+ */
+void test_run(void (*body)(void)) __attribute__((noreturn));
+
+#endif /* TEST_H */
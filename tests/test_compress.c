@@ -0,0 +1,254 @@
+/**
+ * @file
+ * @brief test of the compressed sink
+ *
+ * Every record goes to a plain sink and a compressed sink. The output of the
+ * compressed sink is decompressed and compared with the plain one. The first
+ * record is the worst case for the compressor, a unique character before each
+ * repeat of "abc", which expands rather than compresses. Then a byte is
+ * dropped from the compressed output, which must decode again from the next
+ * reset point (DEBUG_COMPRESS_RESET_INTERVAL is 4 for this test).
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include "test.h"
+
+#include <string.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Most bytes captured per sink */
+#define COMPRESS_CAPTURE    4096
+
+/** @brief Capture of one sink */
+typedef struct {
+    char data[COMPRESS_CAPTURE];
+    size_t length;
+} capture_t;
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Output of each sink, only written by the debug task */
+static volatile capture_t plain;
+static volatile capture_t compressed;
+
+/** @brief Decompressed output of the compressed sink */
+static char decompressed[COMPRESS_CAPTURE];
+
+/** @brief Output of the compressed sink with a byte dropped */
+static uint8_t damaged[COMPRESS_CAPTURE];
+
+/*----------------------------------- Sinks ----------------------------------*/
+
+/**
+ * @brief Add a character to a capture.
+ * @param capture capture to add to.
+ * @param c character to add.
+ */
+static void capture_add(volatile capture_t* capture, char c)
+{
+    if(capture->length < COMPRESS_CAPTURE) {
+        capture->data[capture->length++] = c;
+    }
+}
+
+/**
+ * @brief Plain sink, the reference for the compressed one.
+ * @param c character to write.
+ */
+static void plain_send(char c)
+{
+    capture_add(&plain, c);
+}
+
+/**
+ * @brief Compressed sink.
+ * @param c character to write.
+ */
+static void compressed_send(char c)
+{
+    capture_add(&compressed, c);
+}
+
+/**
+ * @brief Sink initialisation, nothing to do on the host.
+ */
+static void sink_init(void)
+{
+}
+
+/**
+ * @brief Reset function, only called on a panic.
+ */
+static void sink_reset(void)
+{
+    TEST_CHECK(false);
+}
+
+/*---------------------------------- Tests -----------------------------------*/
+
+/**
+ * @brief Decompress compressed output, see DEBUG_COMPRESS_MATCH for the
+ * format. As in the host decoder, decoding starts again after every reset
+ * point (the byte after three or more 0xFF bytes), and bytes up to the next
+ * one are skipped if a repeat reaches back past the last one.
+ * @param data compressed output.
+ * @param length number of bytes.
+ *
+ * @retval number of decompressed bytes, or 0 if they would not fit.
+ */
+static size_t decompress_data(const uint8_t* data, size_t length)
+{
+    size_t size = 0;
+    size_t i = 0;
+    while(i < length) {
+        size_t next = i + 1;
+        while(next < length && (data[next] == 0xFF || next < 3 ||
+                                data[next - 1] != 0xFF ||
+                                data[next - 2] != 0xFF ||
+                                data[next - 3] != 0xFF)) {
+            next++;
+        }
+        size_t start = size;
+        while(i < next) {
+            uint8_t token = data[i++];
+            if(token == 0xFF) {
+                break;
+            }
+            if(token < DEBUG_COMPRESS_MATCH) {
+                size_t count = (size_t)token + 1;
+                if(i + count > next) {
+                    break;
+                }
+                if(size + count > COMPRESS_CAPTURE) {
+                    return 0;
+                }
+                memcpy(&decompressed[size], &data[i], count);
+                i += count;
+                size += count;
+                continue;
+            }
+            size_t match = token - DEBUG_COMPRESS_MATCH +
+                                                    DEBUG_COMPRESS_MIN_MATCH;
+            if(i + 2 > next) {
+                break;
+            }
+            size_t distance = (data[i] | (data[i + 1] << 8)) + 1;
+            i += 2;
+            if(distance > size - start) {
+                break;
+            }
+            if(size + match > COMPRESS_CAPTURE) {
+                return 0;
+            }
+            /* A repeat can run on into the bytes it is repeating */
+            for(size_t j = 0; j < match; j++, size++) {
+                decompressed[size] = decompressed[size - distance];
+            }
+        }
+        i = next;
+    }
+    return size;
+}
+
+/**
+ * @brief Decompress everything the compressed sink has output so far.
+ *
+ * @retval number of decompressed bytes, or 0 if they would not fit.
+ */
+static size_t decompress(void)
+{
+    return decompress_data((const uint8_t*)compressed.data,
+                                                        compressed.length);
+}
+
+/**
+ * @brief Log the worst case for the compressor, then a record that repeats
+ * it, and check both round trip.
+ */
+static void test_compress(void)
+{
+    TEST_CHECK(debugAddCompressedSink(compressed_send, NULL, DEBUG_FULL) == 1);
+
+    /* Longer than a record, so the record is truncated to its full length */
+    static char pattern[DEBUG_MESSAGE_LENGTH];
+    size_t length = 0;
+    for(char unique = '0'; length + 4 < sizeof(pattern); unique++) {
+        pattern[length++] = unique;
+        memcpy(&pattern[length], "abc", 3);
+        length += 3;
+    }
+    pattern[length] = '\0';
+
+    DEBUG_MESSAGE(DEBUG_TYPE_INFO, "%s", pattern);
+    TEST_WAIT(plain.length > 0 && decompress() == plain.length);
+    TEST_CHECK(memcmp(decompressed, (const char*)plain.data,
+                                                        plain.length) == 0);
+    /* More than a record without any repeats would take */
+    size_t expanded = compressed.length;
+    TEST_CHECK(expanded > plain.length + 1 +
+                                plain.length / DEBUG_COMPRESS_MAX_LITERALS);
+
+    DEBUG_MESSAGE(DEBUG_TYPE_INFO, "%s", pattern);
+    size_t first = plain.length;
+    TEST_WAIT(plain.length > first && decompress() == plain.length);
+    TEST_CHECK(memcmp(decompressed, (const char*)plain.data,
+                                                        plain.length) == 0);
+    /* The second record is mostly a repeat of the first */
+    TEST_CHECK(compressed.length - expanded < (plain.length - first) / 4);
+}
+
+/**
+ * @brief Drop a byte from the compressed output, and check that everything
+ * from the next reset point on still decodes.
+ */
+static void test_resync(void)
+{
+    size_t start = compressed.length;
+    size_t offsets[3 * DEBUG_COMPRESS_RESET_INTERVAL];
+    for(int i = 0; i < 3 * DEBUG_COMPRESS_RESET_INTERVAL; i++) {
+        offsets[i] = plain.length;
+        DEBUG_MESSAGE(DEBUG_TYPE_INFO, "resync %d abcdefabcdefabcdef", i);
+        TEST_WAIT(plain.length > offsets[i] &&
+                                        decompress() == plain.length);
+    }
+
+    /* Drop a byte from the first record, inside a repeat of its text */
+    size_t dropped = start + (compressed.length - start) /
+                                        (3 * DEBUG_COMPRESS_RESET_INTERVAL) / 2;
+    memcpy(damaged, (const char*)compressed.data, dropped);
+    memcpy(&damaged[dropped], (const char*)&compressed.data[dropped + 1],
+                                            compressed.length - dropped - 1);
+    size_t size = decompress_data(damaged, compressed.length - 1);
+
+    /* Records after the next reset point must come out whole */
+    size_t tail = plain.length - offsets[DEBUG_COMPRESS_RESET_INTERVAL];
+    TEST_CHECK(size >= tail && memcmp(&decompressed[size - tail],
+            (const char*)&plain.data[offsets[DEBUG_COMPRESS_RESET_INTERVAL]],
+                                                                tail) == 0);
+
+    /* Nor can a decoder that starts mid-stream refer back past its start */
+    size = decompress_data((const uint8_t*)&compressed.data[dropped],
+                                                compressed.length - dropped);
+    TEST_CHECK(size >= tail && memcmp(&decompressed[size - tail],
+            (const char*)&plain.data[offsets[DEBUG_COMPRESS_RESET_INTERVAL]],
+                                                                tail) == 0);
+}
+
+/**
+ * @brief Run every test.
+ */
+static void test_all(void)
+{
+    test_compress();
+    test_resync();
+}
+
+int main(void)
+{
+    debugInitialise(16, sink_init, plain_send, sink_reset);
+    test_run(test_all);
+}
@@ -0,0 +1,194 @@
+/**
+ * @file
+ * @brief test of the ITM sink against fake stimulus port registers
+ *
+ * Every record is also sent to a per-character sink, which is the reference
+ * for the bytes that should reach the stimulus port of its type. Checks that
+ * records are packed into 32-bit little-endian writes with byte writes for
+ * the tail, that each type goes to its own port, and that disabled ports are
+ * skipped.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include "test.h"
+
+#include <string.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Number of stimulus ports the fake registers have */
+#define ITM_PORTS       32
+
+/** @brief Most bytes and writes captured per port */
+#define ITM_CAPTURE     512
+
+/** @brief Capture of one stimulus port */
+typedef struct {
+    char data[ITM_CAPTURE];
+    size_t length;
+    uint8_t sizes[ITM_CAPTURE];
+    size_t writes;
+} itm_port_t;
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Fake stimulus ports, only written by the debug task */
+static volatile itm_port_t itm_ports[ITM_PORTS];
+
+/** @brief Bit per enabled stimulus port */
+static volatile uint32_t itm_enabled = UINT32_MAX;
+
+/** @brief Number of times a port reported it was not ready */
+static volatile unsigned itm_busy;
+
+/** @brief Capture of the reference sink, only written by the debug task */
+static volatile char sink_data[ITM_CAPTURE];
+static volatile size_t sink_length;
+static volatile unsigned sink_records;
+
+/*------------------------------ Fake Registers ------------------------------*/
+
+int itm_fake_enabled(unsigned port)
+{
+    return port < ITM_PORTS && (itm_enabled & (1u << port));
+}
+
+int itm_fake_ready(unsigned port)
+{
+    (void)(port);
+    /* Busy every other poll, so the sink has to wait for the FIFO */
+    static bool ready;
+    ready = !ready;
+    itm_busy += !ready;
+    return ready;
+}
+
+void itm_fake_write(unsigned port, uint32_t value, unsigned size)
+{
+    volatile itm_port_t* capture = &itm_ports[port];
+    for(unsigned i = 0; i < size && capture->length < ITM_CAPTURE; i++) {
+        capture->data[capture->length++] = (char)(value >> (8 * i));
+    }
+    if(capture->writes < ITM_CAPTURE) {
+        capture->sizes[capture->writes++] = (uint8_t)size;
+    }
+}
+
+/*----------------------------------- Sink -----------------------------------*/
+
+/**
+ * @brief Reference sink.
+ * @param c character to write.
+ */
+static void sink_send(char c)
+{
+    if(sink_length < ITM_CAPTURE) {
+        sink_data[sink_length++] = c;
+    }
+    sink_records += (c == '\n');
+}
+
+/**
+ * @brief Sink initialisation, nothing to do on the host.
+ */
+static void sink_init(void)
+{
+}
+
+/**
+ * @brief Reset function, only called on a panic.
+ */
+static void sink_reset(void)
+{
+    TEST_CHECK(false);
+}
+
+/*---------------------------------- Tests -----------------------------------*/
+
+/**
+ * @brief Clear every capture.
+ */
+static void itm_clear(void)
+{
+    memset((void*)itm_ports, 0, sizeof(itm_ports));
+    memset((void*)sink_data, 0, sizeof(sink_data));
+    sink_length = 0;
+    sink_records = 0;
+}
+
+/**
+ * @brief Check that the port holds exactly the reference record, in 32-bit
+ * writes followed by byte writes for the tail.
+ * @param port stimulus port the record should have gone to.
+ *
+ * @retval length of the record modulo 4, i.e. the number of byte writes.
+ */
+static size_t itm_check_port(unsigned port)
+{
+    volatile itm_port_t* capture = &itm_ports[port];
+    TEST_WAIT(sink_records == 1 && capture->length == sink_length);
+    TEST_CHECK(sink_length > 0 && memcmp((void*)capture->data,
+                                    (void*)sink_data, sink_length) == 0);
+
+    size_t words = sink_length / 4;
+    size_t tail = sink_length % 4;
+    TEST_CHECK(capture->writes == words + tail);
+    for(size_t i = 0; i < capture->writes; i++) {
+        TEST_CHECK(capture->sizes[i] == ((i < words) ? 4 : 1));
+    }
+
+    for(unsigned other = 0; other < ITM_PORTS; other++) {
+        TEST_CHECK(other == port || itm_ports[other].writes == 0);
+    }
+    return tail;
+}
+
+/**
+ * @brief Log one record of each type, and records of each length modulo 4.
+ */
+static void test_itm(void)
+{
+    TEST_CHECK(debugAddItmSink(DEBUG_FULL) == 1);
+
+    /* Each type has its own port */
+    static const char types[] = {
+        DEBUG_TYPE_INFO, DEBUG_TYPE_WARNING, DEBUG_TYPE_ERROR
+    };
+    for(unsigned i = 0; i < sizeof(types); i++) {
+        itm_clear();
+        DEBUG_MESSAGE(types[i], "type %c", types[i]);
+        itm_check_port(DEBUG_ITM_PORT + i);
+    }
+
+    /* Eight lengths in a row cover every tail, however the timestamp grows */
+    bool tails[4] = { false };
+    for(int padding = 0; padding < 8; padding++) {
+        itm_clear();
+        DEBUG_MESSAGE(DEBUG_TYPE_WARNING, "padding %.*s", padding,
+                                                                "01234567");
+        tails[itm_check_port(DEBUG_ITM_PORT + 1)] = true;
+    }
+    for(size_t tail = 0; tail < 4; tail++) {
+        TEST_CHECK(tails[tail]);
+    }
+    TEST_CHECK(itm_busy > 0);
+
+    /* A disabled port is skipped, and the other sinks still get the record */
+    itm_clear();
+    itm_enabled &= ~(1u << (DEBUG_ITM_PORT + 2));
+    DEBUG_MESSAGE(DEBUG_TYPE_ERROR, "disabled");
+    TEST_WAIT(sink_records == 1);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    for(unsigned port = 0; port < ITM_PORTS; port++) {
+        TEST_CHECK(itm_ports[port].writes == 0);
+    }
+}
+
+int main(void)
+{
+    debugInitialise(16, sink_init, sink_send, sink_reset);
+    test_run(test_itm);
+}
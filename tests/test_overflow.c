@@ -0,0 +1,223 @@
+/**
+ * @file
+ * @brief test of ring overflow under each DEBUG_OVERFLOW_POLICY
+ *
+ * Built once per policy with DEBUG_TRANSPORT_RING (see the Makefile). The
+ * debug task is suspended while the test task logs half a ring more than fits,
+ * so the ring overflows. Checks which messages come out, that the drops are
+ * counted and reported once there is space, and that discarded messages give
+ * their pool blocks back. With DROP_OLDEST the producer itself advances the
+ * tail past the oldest message, which is repeated until the slot indices have
+ * wrapped round the ring several times. With BLOCK_ERRORS an error waits
+ * DEBUG_OVERFLOW_TIMEOUT for space before it is dropped, other types do not.
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Messages logged while the debug task is suspended */
+#define OVERFLOW_MESSAGES   (DEBUG_RING_LENGTH + DEBUG_RING_LENGTH / 2)
+
+/** @brief Messages each overflow drops */
+#define OVERFLOW_DROPS      (OVERFLOW_MESSAGES - DEBUG_RING_LENGTH)
+
+/** @brief Rounds of overflow, enough to wrap the ring several times */
+#define OVERFLOW_ROUNDS     4
+
+/** @brief Most bytes captured */
+#define OVERFLOW_CAPTURE    8192
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Capture of the sink, only written by the debug task */
+static volatile char sink_data[OVERFLOW_CAPTURE];
+static volatile size_t sink_length;
+static volatile unsigned sink_records;
+
+/*----------------------------------- Sink -----------------------------------*/
+
+/**
+ * @brief Capturing sink.
+ * @param c character to write.
+ */
+static void sink_send(char c)
+{
+    if(sink_length < OVERFLOW_CAPTURE - 1) {
+        sink_data[sink_length++] = c;
+    }
+    sink_records += (c == '\n');
+}
+
+/**
+ * @brief Sink initialisation, nothing to do on the host.
+ */
+static void sink_init(void)
+{
+}
+
+/**
+ * @brief Reset function, only called on a panic.
+ */
+static void sink_reset(void)
+{
+    TEST_CHECK(false);
+}
+
+/*---------------------------------- Tests -----------------------------------*/
+
+/**
+ * @brief Clear the capture.
+ */
+static void overflow_clear(void)
+{
+    memset((void*)sink_data, 0, sizeof(sink_data));
+    sink_length = 0;
+    sink_records = 0;
+}
+
+/**
+ * @brief Find text in the capture.
+ * @param from position to search from.
+ * @param text text to find.
+ *
+ * @retval position just after the text, or 0 if it is not there.
+ */
+static size_t overflow_find(size_t from, const char* text)
+{
+    const char* found = strstr((const char*)&sink_data[from], text);
+    return (found == NULL) ? 0 :
+                        (size_t)(found - (const char*)sink_data) + strlen(text);
+}
+
+/**
+ * @brief Overflow the ring of the test task, then check what comes out.
+ * @param debug_task handle of the debug task.
+ * @param round number of the round.
+ */
+static void test_overflow_round(TaskHandle_t debug_task, int round)
+{
+    overflow_clear();
+    uint32_t dropped = debugGetDropCount(DEBUG_TYPE_INFO);
+
+    vTaskSuspend(debug_task);
+    for(int i = 0; i < OVERFLOW_MESSAGES; i++) {
+        DEBUG_MESSAGE(DEBUG_TYPE_INFO, "round %d message %02d", round, i);
+    }
+    TEST_CHECK(debugGetDropCount(DEBUG_TYPE_INFO) ==
+                                                dropped + OVERFLOW_DROPS);
+    vTaskResume(debug_task);
+    TEST_WAIT(sink_records == DEBUG_RING_LENGTH);
+
+    /* The ring is empty again, so the drops are reported before the next */
+    DEBUG_MESSAGE(DEBUG_TYPE_INFO, "round %d end", round);
+    TEST_WAIT(sink_records == DEBUG_RING_LENGTH + 2);
+
+    /* What is left is a contiguous run of messages, in order */
+    #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST
+        const int first = OVERFLOW_DROPS;
+    #else
+        const int first = 0;
+    #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST */
+    size_t position = 0;
+    char text[32];
+    for(int i = 0; i < OVERFLOW_MESSAGES; i++) {
+        snprintf(text, sizeof(text), "round %d message %02d", round, i);
+        size_t found = overflow_find(0, text);
+        if(i >= first && i < first + DEBUG_RING_LENGTH) {
+            TEST_CHECK(found > position);
+            position = found;
+        } else {
+            TEST_CHECK(found == 0);
+        }
+    }
+    snprintf(text, sizeof(text), "%d messages dropped", OVERFLOW_DROPS);
+    position = overflow_find(position, text);
+    TEST_CHECK(position != 0);
+    snprintf(text, sizeof(text), "round %d end", round);
+    TEST_CHECK(overflow_find(position, text) != 0);
+}
+
+/**
+ * @brief Check that an error waits for space with BLOCK_ERRORS, and that
+ * other types never do.
+ * @param debug_task handle of the debug task.
+ */
+static void test_overflow_wait(TaskHandle_t debug_task)
+{
+    overflow_clear();
+    uint32_t errors = debugGetDropCount(DEBUG_TYPE_ERROR);
+    uint32_t warnings = debugGetDropCount(DEBUG_TYPE_WARNING);
+
+    vTaskSuspend(debug_task);
+    for(int i = 0; i < DEBUG_RING_LENGTH; i++) {
+        DEBUG_MESSAGE(DEBUG_TYPE_INFO, "fill %02d", i);
+    }
+    TickType_t start = xTaskGetTickCount();
+    DEBUG_MESSAGE(DEBUG_TYPE_WARNING, "warning");
+    TickType_t waited = xTaskGetTickCount() - start;
+    #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS
+        TEST_CHECK(waited < DEBUG_OVERFLOW_TIMEOUT);
+    #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS */
+
+    start = xTaskGetTickCount();
+    DEBUG_MESSAGE(DEBUG_TYPE_ERROR, "error");
+    waited = xTaskGetTickCount() - start;
+    #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS
+        TEST_CHECK(waited >= DEBUG_OVERFLOW_TIMEOUT);
+    #else
+        (void)(waited);
+    #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_BLOCK_ERRORS */
+
+    /* DROP_OLDEST makes room for both, at the expense of two fills */
+    #if DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST
+        TEST_CHECK(debugGetDropCount(DEBUG_TYPE_WARNING) == warnings);
+        TEST_CHECK(debugGetDropCount(DEBUG_TYPE_ERROR) == errors);
+    #else
+        TEST_CHECK(debugGetDropCount(DEBUG_TYPE_WARNING) == warnings + 1);
+        TEST_CHECK(debugGetDropCount(DEBUG_TYPE_ERROR) == errors + 1);
+    #endif /* DEBUG_OVERFLOW_POLICY == DEBUG_OVERFLOW_DROP_OLDEST */
+    vTaskResume(debug_task);
+    TEST_WAIT(sink_records == DEBUG_RING_LENGTH);
+}
+
+/**
+ * @brief Overflow the ring round after round, then check the pool.
+ */
+static void test_overflow(void)
+{
+    TaskHandle_t debug_task = xTaskGetHandle("debug");
+    TEST_CHECK(debug_task != NULL);
+
+    for(int round = 0; round < OVERFLOW_ROUNDS; round++) {
+        test_overflow_round(debug_task, round);
+    }
+    test_overflow_wait(debug_task);
+
+    /* Every discarded message gave its block back */
+    TEST_CHECK(debugGetPoolFailures() == 0);
+
+    /* Messages longer than a block are truncated to it, with a marker */
+    overflow_clear();
+    DEBUG_MESSAGE(DEBUG_TYPE_INFO, "%0*d", DEBUG_POOL_BLOCK_SIZE, 0);
+    /* After the report of the drops above */
+    TEST_WAIT(sink_records == 2);
+    const size_t kept = DEBUG_POOL_BLOCK_SIZE - sizeof(DEBUG_TRUNCATION_MARKER);
+    char truncated[DEBUG_POOL_BLOCK_SIZE + 2] = " ";
+    memset(&truncated[1], '0', kept);
+    strcpy(&truncated[1 + kept], DEBUG_TRUNCATION_MARKER "\n");
+    TEST_CHECK(overflow_find(0, truncated) == sink_length);
+}
+
+int main(void)
+{
+    debugInitialise(16, sink_init, sink_send, sink_reset);
+    test_run(test_overflow);
+}
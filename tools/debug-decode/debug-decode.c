@@ -0,0 +1,1231 @@
+/**
+ * @file
+ * @brief host-side decoder for the FreeRTOS-Debug output stream
+ *
+ * Reads a captured debug stream from a file or stdin and prints every record
+ * as text, CSV or JSON lines. Both the text output of debug_handler and the
+ * binary records of DEBUG_MODE_BINARY are understood, even when mixed. Format
+ * strings of binary records are looked up in the firmware ELF file, as are
+ * the call site descriptors of DEBUG_SITES builds. Once a binary record has
+ * been decoded (or from the start with -b), bytes that do not decode are
+ * skipped up to the next sync byte rather than read as a line of text. With
+ * -c, the capture is read as the COBS frames of DEBUG_FRAMED instead. With
+ * -z, the capture of a compressed sink (debugAddCompressedSink) is
+ * decompressed first.
+ *
+ * Usage: debug-decode [-b] [-c] [-z] [-e firmware.elf] [-f text|csv|json]
+ *                                                              [capture]
+ *
+ * @author @htmlonly &copy; @endhtmlonly 2020 James Bennion-Pedley
+ *
+ * @date 16 October 2026
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*------------------------------- Definitions --------------------------------*/
+
+/** @brief Must match the definitions in FreeRTOS-Debug.h */
+#define DEBUG_BINARY_SYNC       0xA5
+#define DEBUG_BINARY_SITE_SYNC  0xA6
+#define DEBUG_BINARY_NAME       'N'
+#define DEBUG_BINARY_BOOT       'B'
+#define DEBUG_BOOT_PREVIOUS     1
+#define DEBUG_FRAME_ABSOLUTE    0x80
+#define DEBUG_FRAME_SITE        0x20
+#define DEBUG_COMPRESS_MATCH        0x80
+#define DEBUG_COMPRESS_MIN_MATCH    3
+#define DEBUG_COMPRESS_RESET_TOKEN  0xFF
+
+/** @brief Largest window a compressed sink can use, must be a power of two */
+#define DECOMPRESS_WINDOW   (1 << 15)
+#define DEBUG_TASK_ID_DEBUG 0xFD
+#define DEBUG_TASK_ID_ISR   0xFE
+#define DEBUG_TASK_ID_NONE  0xFF
+
+/** @brief Largest argument count a binary record can have */
+#define DEBUG_MAX_ARGS      8
+
+/** @brief Longest task name accepted in a binary name record */
+#define DEBUG_MAX_NAME      64
+
+/** @brief Size of each read from the capture */
+#define READ_CHUNK          (1 << 16)
+
+/** @brief Output Formats */
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_JSON
+} output_t;
+
+/** @brief Result of trying to parse a record */
+typedef enum {
+    PARSE_OK,
+    PARSE_NO_RECORD,
+    PARSE_NEED_MORE,
+    PARSE_INVALID
+} parse_t;
+
+/** @brief Growable string */
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} string_t;
+
+/** @brief A decoded record */
+typedef struct {
+    uint32_t timestamp;
+    char type;
+    string_t source;
+    string_t message;
+    string_t location;
+} record_t;
+
+/** @brief Loaded section of the firmware ELF file */
+typedef struct {
+    uint64_t address;
+    uint64_t size;
+    const uint8_t* data;
+} section_t;
+
+/*----------------------------- Global Variables -----------------------------*/
+
+/** @brief Contents of the firmware ELF file */
+static uint8_t* elf_image;
+
+/** @brief Allocated sections with file contents */
+static section_t* elf_sections;
+static size_t elf_section_count;
+
+/** @brief Call site descriptors (debug_sites section) of DEBUG_SITES builds */
+static section_t elf_sites;
+
+/** @brief Whether the firmware is ELF64, which widens debug_site_t */
+static bool elf_is_64;
+
+/** @brief Task names sent by DEBUG_MODE_BINARY, indexed by task ID */
+static char* task_names[256];
+
+/** @brief Selected output format */
+static output_t output_format = OUTPUT_TEXT;
+
+/** @brief Whether the capture is made of DEBUG_FRAMED frames */
+static bool input_framed;
+
+/** @brief Whether the capture is binary, so resynchronise on sync bytes */
+static bool input_binary;
+
+/** @brief Whether the capture comes from a compressed sink */
+static bool input_compressed;
+
+/** @brief State of the decompressor, see read_compressed */
+static struct {
+    uint8_t window[DECOMPRESS_WINDOW];
+    /** Bytes decompressed since the last reset point */
+    uint32_t position;
+    uint8_t input[READ_CHUNK];
+    size_t start;
+    size_t end;
+    enum {
+        TOKEN, LITERALS, DISTANCE_LOW, DISTANCE_HIGH, REPEAT, RESET, LOST
+    } state;
+    size_t remaining;
+    uint32_t distance;
+    /** 0xFF bytes in a row, see DEBUG_COMPRESS_RESET */
+    size_t resets;
+    /** Bytes skipped while LOST */
+    size_t skipped;
+} decompress;
+
+/**
+ * @brief Timestamp of the last framed record of each debug type or a more
+ * severe one (error, warning, info), which frame timestamps are deltas from.
+ */
+static uint32_t frame_timestamps[3];
+
+/*--------------------------------- Strings ----------------------------------*/
+
+/**
+ * @brief Append bytes to a string, growing it as needed.
+ * @param string string to append to.
+ * @param data bytes to append.
+ * @param length number of bytes.
+ */
+static void string_append(string_t* string, const char* data, size_t length)
+{
+    if(string->length + length + 1 > string->capacity) {
+        size_t capacity = string->capacity ? string->capacity : 64;
+        while(string->length + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        string->data = realloc(string->data, capacity);
+        if(string->data == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        string->capacity = capacity;
+    }
+    memcpy(&string->data[string->length], data, length);
+    string->length += length;
+    string->data[string->length] = '\0';
+}
+
+/**
+ * @brief Append printf-style output to a string.
+ * @param string string to append to.
+ * @param format printf-style format string, followed by its arguments.
+ */
+static void string_printf(string_t* string, const char* format, ...)
+                                    __attribute__((format(printf, 2, 3)));
+
+static void string_printf(string_t* string, const char* format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if(length > 0) {
+        string_append(string, buffer, (size_t)length < sizeof(buffer) ?
+                                    (size_t)length : sizeof(buffer) - 1);
+    }
+}
+
+/**
+ * @brief Empty a string without releasing its memory.
+ * @param string string to clear.
+ */
+static void string_clear(string_t* string)
+{
+    string->length = 0;
+    if(string->data != NULL) {
+        string->data[0] = '\0';
+    }
+}
+
+/*-------------------------------- ELF Lookup --------------------------------*/
+
+/**
+ * @brief Read a little-endian value from a byte buffer.
+ * @param data bytes to read.
+ * @param size number of bytes, up to 8.
+ *
+ * @retval value that was read.
+ */
+static uint64_t read_le(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    for(size_t i = size; i > 0; i--) {
+        value = (value << 8) | data[i - 1];
+    }
+    return value;
+}
+
+/**
+ * @brief Load the allocated sections of a little-endian ELF32 or ELF64 file.
+ * @param path path of the ELF file.
+ *
+ * @retval true if the file was loaded.
+ */
+static bool elf_load(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    elf_image = malloc(size > 0 ? (size_t)size : 1);
+    if(elf_image == NULL || fread(elf_image, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    if(size < 0x40 || memcmp(elf_image, "\x7f" "ELF", 4) != 0 ||
+                                                        elf_image[5] != 1) {
+        fprintf(stderr, "%s: not a little-endian ELF file\n", path);
+        return false;
+    }
+    bool is_64 = (elf_image[4] == 2);
+    uint64_t shoff = is_64 ? read_le(&elf_image[0x28], 8) :
+                                                read_le(&elf_image[0x20], 4);
+    size_t shentsize = read_le(&elf_image[is_64 ? 0x3A : 0x2E], 2);
+    size_t shnum = read_le(&elf_image[is_64 ? 0x3C : 0x30], 2);
+    size_t shstrndx = read_le(&elf_image[is_64 ? 0x3E : 0x32], 2);
+    if(shoff + shentsize * shnum > (uint64_t)size) {
+        fprintf(stderr, "%s: truncated section table\n", path);
+        return false;
+    }
+    elf_is_64 = is_64;
+
+    /* Section names are needed to find the call site descriptors */
+    const char* names = NULL;
+    uint64_t names_size = 0;
+    if(shstrndx < shnum) {
+        const uint8_t* header = &elf_image[shoff + shstrndx * shentsize];
+        uint64_t offset = read_le(&header[is_64 ? 0x18 : 0x10], is_64 ? 8 : 4);
+        uint64_t length = read_le(&header[is_64 ? 0x20 : 0x14], is_64 ? 8 : 4);
+        if(offset + length <= (uint64_t)size) {
+            names = (const char*)&elf_image[offset];
+            names_size = length;
+        }
+    }
+
+    elf_sections = calloc(shnum ? shnum : 1, sizeof(section_t));
+    for(size_t i = 0; i < shnum; i++) {
+        const uint8_t* header = &elf_image[shoff + i * shentsize];
+        uint32_t type = read_le(&header[4], 4);
+        uint64_t flags = read_le(&header[8], is_64 ? 8 : 4);
+        uint64_t address = read_le(&header[is_64 ? 0x10 : 0x0C], is_64 ? 8 : 4);
+        uint64_t offset = read_le(&header[is_64 ? 0x18 : 0x10], is_64 ? 8 : 4);
+        uint64_t length = read_le(&header[is_64 ? 0x20 : 0x14], is_64 ? 8 : 4);
+
+        /* Only SHT_PROGBITS sections with SHF_ALLOC hold constant data */
+        if(type != 1 || (flags & 2) == 0 || offset + length > (uint64_t)size) {
+            continue;
+        }
+        elf_sections[elf_section_count].address = address;
+        elf_sections[elf_section_count].size = length;
+        elf_sections[elf_section_count].data = &elf_image[offset];
+
+        uint32_t name = read_le(&header[0], 4);
+        if(names != NULL && name < names_size && strncmp(&names[name],
+                                "debug_sites", names_size - name) == 0) {
+            elf_sites = elf_sections[elf_section_count];
+        }
+        elf_section_count++;
+    }
+    return true;
+}
+
+/**
+ * @brief Find a null-terminated string in the firmware image.
+ * @param address target address of the string.
+ *
+ * @retval pointer to the string, or NULL if it is not in the image.
+ */
+static const char* elf_string(uint64_t address)
+{
+    for(size_t i = 0; i < elf_section_count; i++) {
+        const section_t* section = &elf_sections[i];
+        if(address < section->address ||
+                            address >= section->address + section->size) {
+            continue;
+        }
+        uint64_t offset = address - section->address;
+        if(memchr(&section->data[offset], '\0', section->size - offset)) {
+            return (const char*)&section->data[offset];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Look up a call site descriptor (debug_site_t) of a DEBUG_SITES build.
+ * @param index index of the call site.
+ * @param format set to the format string of the call site.
+ * @param location string the file and line of the call site are appended to.
+ *
+ * @retval true if the call site was found.
+ */
+static bool elf_site(uint32_t index, const char** format, string_t* location)
+{
+    /* format and file pointers, line (2 bytes), module, type, padding */
+    size_t pointer = elf_is_64 ? 8 : 4;
+    size_t entry = pointer * 3;
+    if(elf_sites.data == NULL ||
+                            ((uint64_t)index + 1) * entry > elf_sites.size) {
+        return false;
+    }
+    const uint8_t* site = &elf_sites.data[(size_t)index * entry];
+    *format = elf_string(read_le(&site[0], pointer));
+    if(*format == NULL) {
+        return false;
+    }
+    const char* file = elf_string(read_le(&site[pointer], pointer));
+    string_printf(location, "%s:%u", file ? file : "?",
+                                (unsigned)read_le(&site[pointer * 2], 2));
+    return true;
+}
+
+/*-------------------------------- Formatting --------------------------------*/
+
+/**
+ * @brief Format a message from its format string and 32-bit argument words,
+ * the way the target's printf would.
+ * @param message string the message is appended to.
+ * @param format format string.
+ * @param args argument words.
+ * @param count number of argument words.
+ */
+static void render(string_t* message, const char* format,
+                                        const uint32_t* args, size_t count)
+{
+    size_t next = 0;
+    while(*format != '\0') {
+        const char* percent = strchr(format, '%');
+        if(percent == NULL) {
+            string_append(message, format, strlen(format));
+            return;
+        }
+        string_append(message, format, percent - format);
+        format = percent + 1;
+        if(*format == '%') {
+            string_append(message, "%", 1);
+            format++;
+            continue;
+        }
+
+        /* Rebuild the specification without length modifiers */
+        char spec[32] = "%";
+        size_t used = 1;
+        while(*format != '\0' && strchr("-+ #0123456789.*", *format)) {
+            if(*format == '*') {
+                int value = next < count ? (int32_t)args[next++] : 0;
+                used += snprintf(&spec[used], sizeof(spec) - used, "%d",
+                                                                    value);
+            } else if(used < sizeof(spec) - 2) {
+                spec[used++] = *format;
+            }
+            format++;
+        }
+        while(*format != '\0' && strchr("hljztL", *format)) {
+            format++;
+        }
+        if(*format == '\0') {
+            break;
+        }
+        char conversion = *format++;
+        uint32_t word = next < count ? args[next++] : 0;
+        switch(conversion) {
+            case 'd':
+            case 'i':
+                spec[used++] = 'd';
+                spec[used] = '\0';
+                string_printf(message, spec, (int32_t)word);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                spec[used++] = conversion;
+                spec[used] = '\0';
+                string_printf(message, spec, (unsigned int)word);
+                break;
+            case 'p':
+                string_printf(message, "0x%08x", word);
+                break;
+            case 's':
+                {
+                    const char* string = elf_string(word);
+                    spec[used++] = 's';
+                    spec[used] = '\0';
+                    if(string != NULL) {
+                        string_printf(message, spec, string);
+                    } else {
+                        string_printf(message, "<0x%08x>", word);
+                    }
+                    break;
+                }
+            default:
+                /* Floating point and %n cannot be recovered from a word */
+                string_printf(message, "<%%%c>", conversion);
+                break;
+        }
+    }
+}
+
+/*---------------------------------- Output ----------------------------------*/
+
+/**
+ * @brief Write a string with CSV or JSON escaping.
+ * @param string string to write.
+ * @param json true for JSON escaping, false for CSV.
+ */
+static void write_escaped(const string_t* string, bool json)
+{
+    putchar('"');
+    for(size_t i = 0; i < string->length; i++) {
+        unsigned char c = string->data[i];
+        if(json && (c == '"' || c == '\\')) {
+            putchar('\\');
+            putchar(c);
+        } else if(json && c < 0x20) {
+            printf("\\u%04x", c);
+        } else if(!json && c == '"') {
+            fputs("\"\"", stdout);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Write a decoded record in the selected output format.
+ * @param record record to write.
+ */
+static void output_record(const record_t* record)
+{
+    switch(output_format) {
+        case OUTPUT_TEXT:
+            printf("%u %c - %s - %s\n", record->timestamp, record->type,
+                            record->source.data ? record->source.data : "",
+                            record->message.data ? record->message.data : "");
+            break;
+        case OUTPUT_CSV:
+            printf("%u,%c,", record->timestamp, record->type);
+            write_escaped(&record->source, false);
+            putchar(',');
+            write_escaped(&record->message, false);
+            putchar('\n');
+            break;
+        case OUTPUT_JSON:
+            printf("{\"timestamp\":%u,\"type\":\"%c\",\"source\":",
+                                            record->timestamp, record->type);
+            write_escaped(&record->source, true);
+            fputs(",\"message\":", stdout);
+            write_escaped(&record->message, true);
+            if(record->location.length != 0) {
+                fputs(",\"location\":", stdout);
+                write_escaped(&record->location, true);
+            }
+            fputs("}\n", stdout);
+            break;
+    }
+}
+
+/*--------------------------------- Parsing ----------------------------------*/
+
+/**
+ * @brief Whether a byte is one of the Debug Types.
+ * @param type byte to check.
+ *
+ * @retval true if it is a debug type.
+ */
+static bool valid_type(uint8_t type)
+{
+    return type == 'I' || type == 'W' || type == 'E';
+}
+
+/**
+ * @brief Parse a binary task name record (DEBUG_MODE_BINARY) and add it to
+ * task_names.
+ * @param data bytes, starting with DEBUG_BINARY_SYNC.
+ * @param length number of bytes available.
+ * @param consumed number of bytes the record takes up.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_name(const uint8_t* data, size_t length,
+                                                            size_t* consumed)
+{
+    if(length < 4) {
+        return PARSE_NEED_MORE;
+    }
+    const uint8_t* name = &data[3];
+    const uint8_t* end = memchr(name, '\0', length - 3 < DEBUG_MAX_NAME ?
+                                            length - 3 : DEBUG_MAX_NAME);
+    if(end == NULL) {
+        return (length - 3 < DEBUG_MAX_NAME) ? PARSE_NEED_MORE : PARSE_INVALID;
+    }
+
+    uint8_t id = data[2];
+    free(task_names[id]);
+    task_names[id] = strdup((const char*)name);
+    *consumed = (end - data) + 1;
+    return PARSE_NO_RECORD;
+}
+
+/**
+ * @brief Handle a boot marker (DEBUG_BINARY_BOOT), which comes before and
+ * after the records of the previous boot replayed from the crash log. Task
+ * names and frame timestamps start again, and the marker is output as the
+ * line text mode would have.
+ * @param marker DEBUG_BOOT_PREVIOUS or DEBUG_BOOT_CURRENT.
+ * @param record record for the marker.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_boot(uint8_t marker, record_t* record)
+{
+    for(size_t i = 0; i < 256; i++) {
+        free(task_names[i]);
+        task_names[i] = NULL;
+    }
+    memset(frame_timestamps, 0, sizeof(frame_timestamps));
+    record->type = '?';
+    record->timestamp = 0;
+    string_append(&record->source, "", 0);
+    string_printf(&record->message, (marker == DEBUG_BOOT_PREVIOUS) ?
+                    "--- previous boot ---" : "--- end of previous boot ---");
+    return PARSE_OK;
+}
+
+/**
+ * @brief Fill in the source and message of a binary or framed record.
+ * @param record record to fill in.
+ * @param id task ID of the record.
+ * @param irq IRQ number, if the task ID is DEBUG_TASK_ID_ISR.
+ * @param site true if format is a call site index rather than an address.
+ * @param format format address or call site index.
+ * @param args argument words.
+ * @param count number of argument words.
+ */
+static void fill_record(record_t* record, uint8_t id, int32_t irq, bool site,
+                        uint32_t format, const uint32_t* args, size_t count)
+{
+    switch(id) {
+        case DEBUG_TASK_ID_DEBUG:
+            string_printf(&record->source, "debug");
+            break;
+        case DEBUG_TASK_ID_ISR:
+            string_printf(&record->source, "IRQ%d", irq);
+            break;
+        case DEBUG_TASK_ID_NONE:
+            string_printf(&record->source, "?");
+            break;
+        default:
+            if(task_names[id] != NULL) {
+                string_printf(&record->source, "%s", task_names[id]);
+            } else {
+                string_printf(&record->source, "<task %u>", id);
+            }
+            break;
+    }
+    const char* string = NULL;
+    if(site) {
+        elf_site(format, &string, &record->location);
+    } else {
+        string = elf_string(format);
+    }
+    if(string != NULL) {
+        render(&record->message, string, args, count);
+    } else if(site) {
+        string_printf(&record->message, "<site %u>", format);
+        for(size_t i = 0; i < count; i++) {
+            string_printf(&record->message, " 0x%08x", args[i]);
+        }
+    } else {
+        string_printf(&record->message, "<format 0x%08x>", format);
+        for(size_t i = 0; i < count; i++) {
+            string_printf(&record->message, " 0x%08x", args[i]);
+        }
+    }
+}
+
+/**
+ * @brief Parse a binary record (DEBUG_MODE_BINARY).
+ * @param data bytes, starting with DEBUG_BINARY_SYNC or DEBUG_BINARY_SITE_SYNC.
+ * @param length number of bytes available.
+ * @param record decoded record.
+ * @param consumed number of bytes the record takes up.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_binary(const uint8_t* data, size_t length,
+                                        record_t* record, size_t* consumed)
+{
+    if(length < 3) {
+        return PARSE_NEED_MORE;
+    }
+    bool site = (data[0] == DEBUG_BINARY_SITE_SYNC);
+    if(!site && data[1] == DEBUG_BINARY_NAME) {
+        return parse_name(data, length, consumed);
+    }
+    if(!site && data[1] == DEBUG_BINARY_BOOT) {
+        *consumed = 3;
+        return parse_boot(data[2], record);
+    }
+    if(length < 7) {
+        return PARSE_NEED_MORE;
+    }
+    if(!valid_type(data[1])) {
+        return PARSE_INVALID;
+    }
+
+    uint8_t id = data[6];
+    size_t offset = 7;
+    int32_t irq = 0;
+    if(id == DEBUG_TASK_ID_ISR) {
+        if(length < offset + 2) {
+            return PARSE_NEED_MORE;
+        }
+        irq = (int16_t)read_le(&data[offset], 2);
+        offset += 2;
+    }
+
+    /* Call site index (2 bytes) or format address (4 bytes) */
+    size_t format_size = site ? 2 : 4;
+    if(length < offset + format_size + 1) {
+        return PARSE_NEED_MORE;
+    }
+    uint32_t format = read_le(&data[offset], format_size);
+    size_t count = data[offset + format_size];
+    offset += format_size + 1;
+    if(count > DEBUG_MAX_ARGS) {
+        return PARSE_INVALID;
+    }
+    if(length < offset + count * 4) {
+        return PARSE_NEED_MORE;
+    }
+
+    uint32_t args[DEBUG_MAX_ARGS];
+    for(size_t i = 0; i < count; i++) {
+        args[i] = read_le(&data[offset + i * 4], 4);
+    }
+    offset += count * 4;
+
+    record->type = data[1];
+    record->timestamp = read_le(&data[2], 4);
+    fill_record(record, id, irq, site, format, args, count);
+    *consumed = offset;
+    return PARSE_OK;
+}
+
+/**
+ * @brief Read a varint (DEBUG_FRAMED).
+ * @param data bytes to read.
+ * @param length number of bytes available.
+ * @param offset offset of the varint, moved past it.
+ * @param value value that was read.
+ *
+ * @retval true if a whole varint of at most 32 bits was read.
+ */
+static bool read_varint(const uint8_t* data, size_t length, size_t* offset,
+                                                            uint32_t* value)
+{
+    *value = 0;
+    for(unsigned shift = 0; shift < 35 && *offset < length; shift += 7) {
+        uint8_t byte = data[(*offset)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Undo the zigzag encoding of a signed value (DEBUG_FRAMED).
+ * @param value zigzag encoded value.
+ *
+ * @retval signed value.
+ */
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)((value >> 1) ^ -(value & 1));
+}
+
+/**
+ * @brief Check the CRC-16/CCITT of a decoded frame.
+ * @param data payload followed by its CRC, little-endian.
+ * @param length number of bytes, including the CRC.
+ *
+ * @retval true if the CRC matches.
+ */
+static bool frame_crc_valid(const uint8_t* data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < length - 2; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc << 1) ^ ((crc & 0x8000) ? 0x1021 : 0);
+        }
+    }
+    return crc == read_le(&data[length - 2], 2);
+}
+
+/**
+ * @brief Decode a COBS frame without its delimiter.
+ * @param data encoded bytes.
+ * @param length number of encoded bytes.
+ * @param output buffer of at least length bytes for the decoded bytes.
+ *
+ * @retval number of decoded bytes, or SIZE_MAX if the frame is malformed.
+ */
+static size_t cobs_decode(const uint8_t* data, size_t length, uint8_t* output)
+{
+    size_t decoded = 0;
+    size_t i = 0;
+    while(i < length) {
+        uint8_t code = data[i++];
+        if(code == 0 || i + code - 1 > length) {
+            return SIZE_MAX;
+        }
+        memcpy(&output[decoded], &data[i], code - 1);
+        decoded += code - 1;
+        i += code - 1;
+        /* A zero follows every block that is not full, except the last */
+        if(code != 0xFF && i < length) {
+            output[decoded++] = 0;
+        }
+    }
+    return decoded;
+}
+
+/**
+ * @brief Parse the payload of a frame (DEBUG_FRAMED).
+ * @param data decoded payload, without its CRC.
+ * @param length number of bytes.
+ * @param record decoded record.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_frame(const uint8_t* data, size_t length,
+                                                            record_t* record)
+{
+    if(length < 2) {
+        return PARSE_INVALID;
+    }
+    if(data[0] == DEBUG_BINARY_NAME) {
+        size_t name = length - 2 < DEBUG_MAX_NAME ? length - 2 : DEBUG_MAX_NAME;
+        free(task_names[data[1]]);
+        task_names[data[1]] = strndup((const char*)&data[2], name);
+        return PARSE_NO_RECORD;
+    }
+    if(data[0] == DEBUG_BINARY_BOOT) {
+        return (length == 2) ? parse_boot(data[1], record) : PARSE_INVALID;
+    }
+    uint8_t type = data[0] & ~(DEBUG_FRAME_ABSOLUTE | DEBUG_FRAME_SITE);
+    if(!valid_type(type)) {
+        return PARSE_INVALID;
+    }
+
+    size_t offset = 1;
+    uint32_t value;
+    if(!read_varint(data, length, &offset, &value) || offset >= length) {
+        return PARSE_INVALID;
+    }
+    size_t chain = (type == 'E') ? 0 : (type == 'W') ? 1 : 2;
+    uint32_t timestamp = value;
+    if((data[0] & DEBUG_FRAME_ABSOLUTE) == 0) {
+        timestamp = frame_timestamps[chain] + (uint32_t)unzigzag(value);
+    }
+
+    uint8_t id = data[offset++];
+    int32_t irq = 0;
+    if(id == DEBUG_TASK_ID_ISR) {
+        if(!read_varint(data, length, &offset, &value)) {
+            return PARSE_INVALID;
+        }
+        irq = unzigzag(value);
+    }
+    uint32_t format;
+    if(!read_varint(data, length, &offset, &format)) {
+        return PARSE_INVALID;
+    }
+    uint32_t args[DEBUG_MAX_ARGS];
+    size_t count = 0;
+    while(offset < length) {
+        if(count == DEBUG_MAX_ARGS ||
+                                !read_varint(data, length, &offset, &value)) {
+            return PARSE_INVALID;
+        }
+        args[count++] = (uint32_t)unzigzag(value);
+    }
+
+    /* Only a valid record moves the chains on */
+    for(size_t i = chain; i < 3; i++) {
+        frame_timestamps[i] = timestamp;
+    }
+    record->type = type;
+    record->timestamp = timestamp;
+    fill_record(record, id, irq, (data[0] & DEBUG_FRAME_SITE) != 0, format,
+                                                                args, count);
+    return PARSE_OK;
+}
+
+/**
+ * @brief Decode a frame (DEBUG_FRAMED) and check its CRC.
+ * @param data encoded bytes, without the delimiter.
+ * @param length number of encoded bytes.
+ * @param record decoded record.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_framed(const uint8_t* data, size_t length,
+                                                            record_t* record)
+{
+    static uint8_t* decoded;
+    static size_t capacity;
+    if(length > capacity) {
+        decoded = realloc(decoded, length);
+        if(decoded == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        capacity = length;
+    }
+    size_t size = cobs_decode(data, length, decoded);
+    if(size == SIZE_MAX || size < 3 || !frame_crc_valid(decoded, size)) {
+        return PARSE_INVALID;
+    }
+    return parse_frame(decoded, size - 2, record);
+}
+
+/**
+ * @brief Parse a text line ("timestamp T - source - message").
+ * Lines in any other form are passed through as the message.
+ * @param data bytes, starting at the beginning of a line.
+ * @param length number of bytes available.
+ * @param at_end true if no more bytes will follow.
+ * @param record decoded record.
+ * @param consumed number of bytes the line takes up.
+ *
+ * @retval result of the parse.
+ */
+static parse_t parse_text(const uint8_t* data, size_t length, bool at_end,
+                                        record_t* record, size_t* consumed)
+{
+    const uint8_t* newline = memchr(data, '\n', length);
+    if(newline == NULL && !at_end) {
+        return PARSE_NEED_MORE;
+    }
+    size_t line = newline ? (size_t)(newline - data) : length;
+    *consumed = newline ? line + 1 : line;
+    if(line > 0 && data[line - 1] == '\r') {
+        line--;
+    }
+
+    size_t i = 0;
+    uint32_t timestamp = 0;
+    while(i < line && data[i] >= '0' && data[i] <= '9') {
+        timestamp = timestamp * 10 + (data[i++] - '0');
+    }
+    const char* rest = (const char*)&data[i];
+    size_t remaining = line - i;
+    const char* separator = NULL;
+    if(i > 0 && remaining >= 5 && rest[0] == ' ' && valid_type(rest[1]) &&
+                                            memcmp(&rest[2], " - ", 3) == 0) {
+        for(size_t j = 5; j + 3 <= remaining; j++) {
+            if(memcmp(&rest[j], " - ", 3) == 0) {
+                separator = &rest[j];
+                break;
+            }
+        }
+    }
+
+    if(separator == NULL) {
+        record->type = '?';
+        record->timestamp = 0;
+        string_append(&record->source, "", 0);
+        string_append(&record->message, (const char*)data, line);
+    } else {
+        record->type = rest[1];
+        record->timestamp = timestamp;
+        string_append(&record->source, &rest[5], separator - &rest[5]);
+        string_append(&record->message, separator + 3,
+                                            &rest[remaining] - separator - 3);
+    }
+    return PARSE_OK;
+}
+
+/**
+ * @brief Read the output of a compressed sink and decompress it. Three 0xFF
+ * bytes in a row only occur at a reset point (DEBUG_COMPRESS_RESET), so
+ * decoding starts again after every one, even if bytes were lost before it.
+ * A repeat from before the last reset point shows that bytes were lost, or
+ * that the capture started mid-stream, and bytes are skipped up to the next
+ * one.
+ * @param fd file descriptor to read from.
+ * @param output buffer for the decompressed bytes.
+ * @param size size of the buffer.
+ *
+ * @retval number of decompressed bytes, 0 at the end of the capture or -1 on
+ * error.
+ */
+static ssize_t read_compressed(int fd, uint8_t* output, size_t size)
+{
+    size_t produced = 0;
+    while(produced < size) {
+        uint8_t byte;
+        if(decompress.state == REPEAT) {
+            byte = decompress.window[(decompress.position -
+                            decompress.distance) % DECOMPRESS_WINDOW];
+        } else {
+            if(decompress.start == decompress.end) {
+                /* Return what there is, so live pipes keep flowing */
+                if(produced != 0) {
+                    break;
+                }
+                ssize_t count = read(fd, decompress.input,
+                                                sizeof(decompress.input));
+                if(count <= 0) {
+                    return count;
+                }
+                decompress.start = 0;
+                decompress.end = count;
+            }
+            byte = decompress.input[decompress.start++];
+            /* The byte after a reset point is a token, whatever came before */
+            if(byte != 0xFF && decompress.resets >= 3) {
+                decompress.position = 0;
+                decompress.state = TOKEN;
+            }
+            decompress.resets = (byte == 0xFF) ? decompress.resets + 1 : 0;
+        }
+
+        switch(decompress.state) {
+            case LOST:
+                decompress.skipped++;
+                continue;
+            case RESET:
+                if(byte != 0xFF) {
+                    decompress.skipped++;
+                    decompress.state = LOST;
+                }
+                continue;
+            case TOKEN:
+                if(byte == DEBUG_COMPRESS_RESET_TOKEN) {
+                    decompress.state = RESET;
+                } else if(byte & DEBUG_COMPRESS_MATCH) {
+                    decompress.remaining = (byte & ~DEBUG_COMPRESS_MATCH) +
+                                                    DEBUG_COMPRESS_MIN_MATCH;
+                    decompress.state = DISTANCE_LOW;
+                } else {
+                    decompress.remaining = byte + 1;
+                    decompress.state = LITERALS;
+                }
+                continue;
+            case DISTANCE_LOW:
+                decompress.distance = byte;
+                decompress.state = DISTANCE_HIGH;
+                continue;
+            case DISTANCE_HIGH:
+                decompress.distance |= (uint32_t)byte << 8;
+                decompress.distance++;
+                decompress.state = REPEAT;
+                if(decompress.distance > decompress.position ||
+                                decompress.distance > DECOMPRESS_WINDOW) {
+                    decompress.skipped += 3;
+                    decompress.state = LOST;
+                }
+                continue;
+            case LITERALS:
+            case REPEAT:
+                break;
+        }
+        output[produced++] = byte;
+        decompress.window[decompress.position++ % DECOMPRESS_WINDOW] = byte;
+        if(--decompress.remaining == 0) {
+            decompress.state = TOKEN;
+        }
+    }
+    return produced;
+}
+
+/**
+ * @brief Decode a whole capture.
+ * @param input capture to read.
+ *
+ * @retval number of bytes that could not be decoded.
+ */
+static size_t decode(FILE* input)
+{
+    size_t capacity = READ_CHUNK * 2;
+    uint8_t* buffer = malloc(capacity);
+    size_t start = 0;
+    size_t end = 0;
+    size_t skipped = 0;
+    bool at_end = false;
+    bool need_more = false;
+    record_t record = {0};
+
+    for(;;) {
+        /*
+         * Only read once everything buffered has been parsed, so records
+         * from a live pipe are printed as soon as they arrive
+         */
+        if(!at_end && (need_more || start == end)) {
+            /* Move what is left to the front and top the buffer up */
+            memmove(buffer, &buffer[start], end - start);
+            end -= start;
+            start = 0;
+            if(capacity - end < READ_CHUNK) {
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+                if(buffer == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            /* read() returns what is available, so live pipes keep flowing */
+            int fd = fileno(input);
+            ssize_t count = input_compressed ?
+                        read_compressed(fd, &buffer[end], capacity - end) :
+                        read(fd, &buffer[end], capacity - end);
+            if(count > 0) {
+                end += count;
+            } else {
+                at_end = true;
+            }
+            need_more = false;
+        }
+        if(start == end) {
+            if(at_end) {
+                break;
+            }
+            continue;
+        }
+
+        size_t consumed = 0;
+        string_clear(&record.source);
+        string_clear(&record.message);
+        string_clear(&record.location);
+        parse_t result;
+        if(input_framed) {
+            const uint8_t* delimiter = memchr(&buffer[start], 0, end - start);
+            if(delimiter == NULL && !at_end) {
+                need_more = true;
+                continue;
+            }
+            /* A bad frame is dropped whole, and decoding resumes after it */
+            size_t frame = delimiter ? (size_t)(delimiter - &buffer[start]) :
+                                                                end - start;
+            consumed = delimiter ? frame + 1 : frame;
+            result = (frame == 0) ? PARSE_NO_RECORD :
+                        parse_framed(&buffer[start], frame, &record);
+            if(result == PARSE_INVALID) {
+                skipped += consumed;
+                result = PARSE_NO_RECORD;
+            }
+        } else if(buffer[start] == DEBUG_BINARY_SYNC ||
+                                    buffer[start] == DEBUG_BINARY_SITE_SYNC) {
+            result = parse_binary(&buffer[start], end - start, &record,
+                                                                    &consumed);
+            input_binary |= (result == PARSE_OK);
+        } else if(input_binary) {
+            /* A binary stream may not have a newline for a long time */
+            size_t next = start + 1;
+            while(next < end && buffer[next] != DEBUG_BINARY_SYNC &&
+                                    buffer[next] != DEBUG_BINARY_SITE_SYNC) {
+                next++;
+            }
+            skipped += next - start;
+            start = next;
+            continue;
+        } else {
+            result = parse_text(&buffer[start], end - start, at_end, &record,
+                                                                    &consumed);
+        }
+
+        if(result == PARSE_OK || result == PARSE_NO_RECORD) {
+            if(result == PARSE_OK) {
+                output_record(&record);
+            }
+            start += consumed;
+        } else if(result == PARSE_INVALID ||
+                            (at_end && result == PARSE_NEED_MORE)) {
+            /* Resynchronise on the next byte */
+            skipped++;
+            start++;
+        } else {
+            need_more = true;
+        }
+    }
+
+    free(buffer);
+    free(record.source.data);
+    free(record.message.data);
+    free(record.location.data);
+    return skipped;
+}
+
+/*------------------------------------ Main ----------------------------------*/
+
+/**
+ * @brief Print the command line usage.
+ * @param name name of the program.
+ */
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-b] [-c] [-z] [-e firmware.elf] [-f text|csv|json] "
+                                                            "[capture]\n"
+        "  -b  capture is binary (DEBUG_MODE_BINARY) from its first byte\n"
+        "  -c  capture is made of COBS frames (DEBUG_FRAMED)\n"
+        "  -z  capture comes from a compressed sink\n"
+        "  -e  ELF file used to look up format strings of binary records\n"
+        "  -f  output format (default text)\n"
+        "Reads the capture from stdin if no file (or '-') is given.\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int option;
+    while((option = getopt(argc, argv, "bcze:f:h")) != -1) {
+        switch(option) {
+            case 'b':
+                input_binary = true;
+                break;
+            case 'c':
+                input_framed = true;
+                break;
+            case 'z':
+                input_compressed = true;
+                break;
+            case 'e':
+                if(!elf_load(optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                if(strcmp(optarg, "text") == 0) {
+                    output_format = OUTPUT_TEXT;
+                } else if(strcmp(optarg, "csv") == 0) {
+                    output_format = OUTPUT_CSV;
+                } else if(strcmp(optarg, "json") == 0) {
+                    output_format = OUTPUT_JSON;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return (option == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    FILE* input = stdin;
+    if(optind < argc && strcmp(argv[optind], "-") != 0) {
+        input = fopen(argv[optind], "rb");
+        if(input == NULL) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Records are only flushed per line when someone is watching */
+    static char output_buffer[1 << 16];
+    if(!isatty(fileno(stdout))) {
+        setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+    }
+    if(output_format == OUTPUT_CSV) {
+        puts("timestamp,type,source,message");
+    }
+
+    size_t skipped = decode(input) + decompress.skipped;
+    fflush(stdout);
+    if(skipped != 0) {
+        fprintf(stderr, "%zu bytes could not be decoded\n", skipped);
+    }
+    if(input != stdin) {
+        fclose(input);
+    }
+    return EXIT_SUCCESS;
+}